@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "audio.h"
+#include "instrument.h"
+#include "voice.h"
+#include "upsample.h"
+#include "limiter.h"
+#include "dsp.h"
+
+#include "config.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "driver/i2s_std.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_cpu.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static const char *tag = "audio";
+
+
+#define BUFFER_SIZE CONFIG_AUDIO_BLOCK_SIZE
+static synth_mix_t buffer[BUFFER_SIZE];
+
+_Static_assert(SYNTH_BLOCK * CONFIG_SYNTH_UPSAMPLE == BUFFER_SIZE,
+               "Upsampling factor must divide the block size");
+
+#if CONFIG_SYNTH_UPSAMPLE > 1
+static synth_mix_t synth_buffer[SYNTH_BLOCK];
+static struct upsampler upsampler;
+#endif
+
+#if CONFIG_AUDIO_LIMITER
+_Static_assert(BUFFER_SIZE % LIMITER_CHUNK == 0,
+               "Block size must be a multiple of the limiter chunk");
+
+/* Leave some headroom for the soft clipper. */
+# define LIMITER_THRESHOLD (INT16_MAX * 1.5f)
+# define LIMITER_RELEASE_MS 200
+
+static struct limiter limiter;
+#endif
+
+#define RING_DEPTH CONFIG_AUDIO_RING_DEPTH
+
+#if CONFIG_AUDIO_ZERO_COPY
+/* DMA buffers the driver has just sent, ready to be rendered into. */
+static QueueHandle_t sent_blocks;
+
+/* Block rendered while the amplifier is off, to detect sound. */
+static int16_t staging[BUFFER_SIZE];
+
+/* DMA buffer holding a key event we wait to hear and when it came. */
+static int16_t *volatile probe_block;
+static int64_t probe_time;
+#else
+/* Rendered blocks and their peak levels. */
+static int16_t ring[RING_DEPTH][BUFFER_SIZE];
+static int ring_level[RING_DEPTH];
+
+/* Indices of blocks to render into and blocks ready to be written. */
+static QueueHandle_t free_blocks, full_blocks;
+#endif
+
+static struct audio_stats stats;
+
+/* CPU cycles in one block period. */
+#define BLOCK_CYCLES ((uint64_t)BUFFER_SIZE * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000 \
+                      / CONFIG_SAMPLE_FREQ)
+
+static i2s_chan_handle_t snd;
+
+float volume = 0.25;
+bool quiet = false;
+
+
+/* Only a few additions per block, cheap enough to always run. */
+static void count_render(uint32_t cycles)
+{
+	int bucket = cycles * AUDIO_HIST_BUCKETS / BLOCK_CYCLES;
+
+	if (bucket >= AUDIO_HIST_BUCKETS) {
+		bucket = AUDIO_HIST_BUCKETS - 1;
+		stats.deadline_misses++;
+	}
+
+	stats.hist[bucket]++;
+	stats.rendered++;
+	stats.sum_cycles += cycles;
+
+	if (cycles > stats.max_cycles)
+		stats.max_cycles = cycles;
+}
+
+
+/*
+ * Pace of rendering with the output off. Blocks shorter than a tick
+ * would round down to no wait at all and spin.
+ */
+#define IDLE_TICKS (pdMS_TO_TICKS(BUFFER_SIZE * 1000 / CONFIG_SAMPLE_FREQ) > 0 \
+                    ? pdMS_TO_TICKS(BUFFER_SIZE * 1000 / CONFIG_SAMPLE_FREQ) : 1)
+
+/* Block period in microseconds, for the event clock. */
+#define BLOCK_US ((int64_t)BUFFER_SIZE * 1000000 / CONFIG_SAMPLE_FREQ)
+
+/* Timestamp the next block starts at and samples rendered since then. */
+static int64_t clock_base;
+static uint64_t clock_samples;
+
+/* Time of the first key event in the last rendered block, zero if none. */
+static int64_t block_event;
+
+
+/* Time the block about to be rendered stands for. */
+static int64_t block_start(void)
+{
+	int64_t now = esp_timer_get_time();
+	int64_t start = clock_base + (int64_t)(clock_samples * 1000000 / CONFIG_SAMPLE_FREQ);
+
+	/*
+	 * Blocks cover the period just before they are rendered.
+	 * Start over when we fall behind, after a pause for example, and
+	 * when rendering ahead in a burst would have the block start after
+	 * the events meant for it arrive, placing them all at its start.
+	 */
+	if (now - start > 2 * BLOCK_US || start > now - BLOCK_US) {
+		clock_base = now - BLOCK_US;
+		clock_samples = 0;
+		start = clock_base;
+	}
+
+	clock_samples += BUFFER_SIZE;
+	return start;
+}
+
+
+/*
+ * Render the instrument into <mix>, applying key events at the very
+ * sample they belong to. The block is split wherever one falls.
+ */
+static void render_events(synth_mix_t *mix)
+{
+	int64_t start = block_start();
+	size_t pos = 0;
+
+	block_event = 0;
+
+	while (pos < SYNTH_BLOCK) {
+		size_t next = SYNTH_BLOCK;
+		int64_t time;
+
+		while (instrument_peek_event(&time)) {
+			int64_t at = (time - start) * SYNTH_FREQ / 1000000;
+
+			/* Later ones wait for their own block. */
+			if (at > (int64_t)pos) {
+				next = at < SYNTH_BLOCK ? at : SYNTH_BLOCK;
+				break;
+			}
+
+			if (!block_event)
+				block_event = time;
+
+			instrument_dispatch();
+		}
+
+		/*
+		 * Add samples from all strings to the buffer.
+		 * Most are going to be zeroes.
+		 */
+		instrument->read(mix + pos, next - pos);
+		pos = next;
+	}
+}
+
+
+/* Render a block of final samples, return its peak level. */
+static int render(int16_t *out)
+{
+	uint32_t start = esp_cpu_get_cycle_count();
+
+#if CONFIG_SYNTH_UPSAMPLE > 1
+	dsp_clear(synth_buffer, SYNTH_BLOCK);
+
+	/* Render at the synthesis rate and bring it up to the output one. */
+	render_events(synth_buffer);
+	upsampler_run(&upsampler, synth_buffer, buffer, SYNTH_BLOCK);
+#else
+	dsp_clear(buffer, BUFFER_SIZE);
+	render_events(buffer);
+#endif
+
+	/* Take quiet setting into account. */
+	float normal_volume = volume * (quiet ? 0.5 : 1.0);
+
+	dsp_gain(buffer, normal_volume, BUFFER_SIZE);
+
+#if CONFIG_AUDIO_LIMITER
+	limiter_run(&limiter, buffer, BUFFER_SIZE);
+	limiter_clip(out, buffer, BUFFER_SIZE);
+#else
+	dsp_to_i16(out, buffer, BUFFER_SIZE);
+#endif
+
+	int level = dsp_peak_i16(out, BUFFER_SIZE);
+
+	count_render(esp_cpu_get_cycle_count() - start);
+
+	return level;
+}
+
+
+static void log_stats(void)
+{
+	ESP_LOGI(tag, "Ring: %u blocks, %u underruns, fill min %u avg %.2f",
+	         stats.blocks, stats.underruns, stats.min_fill,
+	         stats.blocks ? (float)stats.fill_sum / stats.blocks : 0.0f);
+}
+
+
+static void count_block(unsigned fill)
+{
+	if (!stats.blocks || fill < stats.min_fill)
+		stats.min_fill = fill;
+
+	stats.fill_sum += fill;
+	stats.blocks++;
+}
+
+
+#if CONFIG_AUDIO_ZERO_COPY
+static IRAM_ATTR void count_probe(int64_t us)
+{
+	if (us > stats.max_probe_us)
+		stats.max_probe_us = us;
+
+	stats.sum_probe_us += us;
+	stats.probes++;
+}
+
+
+static IRAM_ATTR bool on_sent(i2s_chan_handle_t handle, i2s_event_data_t *event, void *arg)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+	int16_t *block = event->dma_buf;
+#else
+	int16_t *block = *(int16_t **)event->data;
+#endif
+	BaseType_t wake = pdFALSE;
+
+	/* Key event of this block has just been heard in full. */
+	if (block == probe_block) {
+		count_probe(esp_timer_get_time() - probe_time);
+		probe_block = NULL;
+	}
+
+	/* Played out, so it can be rendered into again. */
+	xQueueSendFromISR(sent_blocks, &block, &wake);
+
+	return wake;
+}
+
+
+static void render_task(void *arg)
+{
+	static bool enabled = false;
+	static int idle = 0;
+
+	while (true) {
+		if (!enabled) {
+			/* Nothing is playing, render aside and pace ourselves. */
+			if (!render(staging)) {
+				vTaskDelay(IDLE_TICKS);
+				continue;
+			}
+
+			ESP_LOGI(tag, "Enable audio...");
+			size_t loaded = 0;
+			ESP_ERROR_CHECK(i2s_channel_preload_data(snd, staging, sizeof(staging), &loaded));
+
+			/* Fill the other DMA buffers too, they would play silence first. */
+			for (int i = 1; i < RING_DEPTH; i++) {
+				render(staging);
+				ESP_ERROR_CHECK(i2s_channel_preload_data(snd, staging, sizeof(staging),
+				                                         &loaded));
+			}
+
+			ESP_ERROR_CHECK(i2s_channel_enable(snd));
+			enabled = true;
+			idle = 0;
+			continue;
+		}
+
+		/* Wait for the interrupt to hand over a DMA buffer. */
+		int16_t *block;
+		xQueueReceive(sent_blocks, &block, portMAX_DELAY);
+
+		/* Sent buffers we have not rendered into yet are not ahead. */
+		unsigned waiting = uxQueueMessagesWaiting(sent_blocks);
+		unsigned fill = waiting < RING_DEPTH - 1 ? RING_DEPTH - 1 - waiting : 0;
+
+		if (!fill)
+			stats.underruns++;
+
+		count_block(fill);
+
+		/* Peak of the block. When it hits zero for long enough,
+		 * we stop the output and disable the amplifier. */
+		int level = render(block);
+
+		/* Time one key event at a time until it is played. */
+		if (block_event && !probe_block) {
+			probe_time = block_event;
+			probe_block = block;
+		}
+
+		if (level) {
+			idle = 0;
+		} else if (++idle >= 100) {
+			ESP_LOGI(tag, "Disable audio...");
+			ESP_ERROR_CHECK(i2s_channel_disable(snd));
+			xQueueReset(sent_blocks);
+			probe_block = NULL;
+			enabled = false;
+			log_stats();
+		}
+	}
+}
+#else
+static IRAM_ATTR bool on_send_q_ovf(i2s_chan_handle_t handle, i2s_event_data_t *event, void *arg)
+{
+	/* Driver has played out everything we gave it. */
+	stats.i2s_overflows++;
+	return false;
+}
+
+
+static void render_task(void *arg)
+{
+	while (true) {
+		int index;
+		xQueueReceive(free_blocks, &index, portMAX_DELAY);
+
+		ring_level[index] = render(ring[index]);
+
+		xQueueSend(full_blocks, &index, portMAX_DELAY);
+	}
+}
+
+
+static void write_task(void *arg)
+{
+	static bool enabled = false;
+	static int idle = 0;
+
+	while (true) {
+		int index;
+		unsigned fill = uxQueueMessagesWaiting(full_blocks);
+
+		if (!fill && enabled)
+			stats.underruns++;
+
+		xQueueReceive(full_blocks, &index, portMAX_DELAY);
+
+		/* Peak of the block. When it hits zero, we do not output
+		 * anything but rather disable the amplifier. */
+		int level = ring_level[index];
+
+		if (level && !enabled) {
+			ESP_LOGI(tag, "Enable audio...");
+			ESP_ERROR_CHECK(i2s_channel_enable(snd));
+			enabled = true;
+			idle = 0;
+		} else if (!level && enabled && (++idle >= 100)) {
+			ESP_LOGI(tag, "Disable audio...");
+			ESP_ERROR_CHECK(i2s_channel_disable(snd));
+			enabled = false;
+			log_stats();
+		}
+
+		if (!enabled) {
+			/* Keep pace with the output anyway. */
+			xQueueSend(free_blocks, &index, portMAX_DELAY);
+			vTaskDelay(IDLE_TICKS);
+			continue;
+		}
+
+		count_block(fill);
+
+		/*
+		 * Our buffer is small, so we should be able to emit it whole.
+		 */
+		size_t total = BUFFER_SIZE * sizeof(int16_t);
+		size_t written = 0;
+
+		ESP_ERROR_CHECK(i2s_channel_write(snd, ring[index], total, &written, portMAX_DELAY));
+		assert (total == written);
+
+		xQueueSend(free_blocks, &index, portMAX_DELAY);
+	}
+}
+#endif
+
+
+void audio_get_stats(struct audio_stats *out)
+{
+	*out = stats;
+}
+
+
+void audio_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+
+static float samples_ms(float samples)
+{
+	return samples * 1000 / CONFIG_SAMPLE_FREQ;
+}
+
+
+/*
+ * Estimate what a key press may have to wait for before it is heard,
+ * computed from the configuration. Rendering and interrupts are assumed
+ * to keep up, this is the buffering. Zero-copy mode measures it as well,
+ * see the "audio" command.
+ */
+static void report_latency(void)
+{
+	/* A key waits for the next scan and then for the next block. */
+	float scan = CONFIG_KEY_SCAN_INTERVAL;
+	float block = samples_ms(BUFFER_SIZE);
+
+#if CONFIG_AUDIO_ZERO_COPY
+	/* Block goes to the buffer that plays after all the others. */
+	float ring_ms = samples_ms((RING_DEPTH - 1) * BUFFER_SIZE);
+	float dma = 0;
+#else
+	float ring_ms = samples_ms(RING_DEPTH * BUFFER_SIZE);
+	float dma = samples_ms(CONFIG_AUDIO_DMA_DESC_NUM * CONFIG_AUDIO_DMA_FRAME_NUM);
+#endif
+
+	float filters = 0;
+
+#if CONFIG_SYNTH_UPSAMPLE > 1
+	filters += samples_ms(UPSAMPLE_TAPS / 2 * CONFIG_SYNTH_UPSAMPLE);
+#endif
+#if CONFIG_AUDIO_LIMITER
+	filters += samples_ms(LIMITER_CHUNK);
+#endif
+
+	ESP_LOGI(tag, "Latency estimate: scan %.1f + block %.1f + ring %.1f + dma %.1f + filters %.1f ms",
+	         scan, block, ring_ms, dma, filters);
+	ESP_LOGI(tag, "Latency estimate: %.1f ms worst case from key to sound",
+	         scan + block + ring_ms + dma + filters);
+}
+
+
+static int cmd_audio(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "reset")) {
+		audio_reset_stats();
+		printf("Audio statistics reset.\n");
+		return 0;
+	}
+
+	struct audio_stats st;
+	audio_get_stats(&st);
+
+	float period = (float)BUFFER_SIZE * 1000 / CONFIG_SAMPLE_FREQ;
+	float cycles_ms = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000.0f;
+
+	printf("Rendered %u blocks of %.2f ms, %u past the deadline\n",
+	       st.rendered, period, st.deadline_misses);
+	printf("Render time: max %.3f ms, mean %.3f ms\n",
+	       st.max_cycles / cycles_ms,
+	       st.rendered ? st.sum_cycles / st.rendered / cycles_ms : 0.0f);
+
+	/* Last bucket holds the missed deadlines as well. */
+	for (int i = 0; i < AUDIO_HIST_BUCKETS - 1; i++)
+		printf("  %3i-%3i%%: %u\n", i * 100 / AUDIO_HIST_BUCKETS,
+		       (i + 1) * 100 / AUDIO_HIST_BUCKETS, st.hist[i]);
+
+	printf("  %3i%%+    : %u\n", (AUDIO_HIST_BUCKETS - 1) * 100 / AUDIO_HIST_BUCKETS,
+	       st.hist[AUDIO_HIST_BUCKETS - 1]);
+
+	printf("Written %u blocks, %u underruns, %u i2s overflows\n",
+	       st.blocks, st.underruns, st.i2s_overflows);
+	printf("Ring fill: min %u, avg %.2f\n", st.min_fill,
+	       st.blocks ? (float)st.fill_sum / st.blocks : 0.0f);
+
+#if CONFIG_AUDIO_ZERO_COPY
+	/* Scan interval comes on top, events are stamped once scanned. */
+	printf("Key to sound: %u events, max %.2f ms, mean %.2f ms\n",
+	       st.probes, st.max_probe_us / 1000.0f,
+	       st.probes ? st.sum_probe_us / st.probes / 1000.0f : 0.0f);
+#endif
+
+	return 0;
+}
+
+
+void audio_register_commands(void)
+{
+	const esp_console_cmd_t cmd = {
+		.command = "audio",
+		.help = "Print audio timing statistics, or reset them",
+		.hint = "[reset]",
+		.func = cmd_audio,
+	};
+
+	ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+
+void audio_init(void)
+{
+	ESP_LOGI(tag, "Configure i2s output...");
+	i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
+	chan_cfg.auto_clear = true;
+
+#if CONFIG_AUDIO_ZERO_COPY
+	/* One DMA buffer per block, the descriptors form the ring. */
+	chan_cfg.dma_desc_num = RING_DEPTH;
+	chan_cfg.dma_frame_num = BUFFER_SIZE;
+#else
+	chan_cfg.dma_desc_num = CONFIG_AUDIO_DMA_DESC_NUM;
+	chan_cfg.dma_frame_num = CONFIG_AUDIO_DMA_FRAME_NUM;
+#endif
+
+	ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &snd, NULL));
+
+	i2s_std_config_t std_cfg = {
+		.clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(CONFIG_SAMPLE_FREQ),
+		.slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+		.gpio_cfg = {
+			.mclk = I2S_GPIO_UNUSED,
+			.bclk = GPIO_NUM_33,
+			.ws = GPIO_NUM_32,
+			.dout = GPIO_NUM_25,
+			.din = I2S_GPIO_UNUSED,
+		},
+	};
+
+	ESP_ERROR_CHECK(i2s_channel_init_std_mode(snd, &std_cfg));
+
+#if CONFIG_SYNTH_UPSAMPLE > 1
+	ESP_LOGI(tag, "Upsample from %i Hz to %i Hz...", SYNTH_FREQ, CONFIG_SAMPLE_FREQ);
+	upsampler_init(&upsampler, CONFIG_SYNTH_UPSAMPLE);
+#endif
+
+#if CONFIG_AUDIO_LIMITER
+	ESP_LOGI(tag, "Limit the master bus...");
+	limiter_init(&limiter, LIMITER_THRESHOLD, LIMITER_RELEASE_MS);
+#endif
+
+#if CONFIG_AUDIO_ZERO_COPY
+	ESP_LOGI(tag, "Render straight into %i DMA buffers of %i samples...",
+	         RING_DEPTH, BUFFER_SIZE);
+
+	/* Room for all buffers twice over, in case we fall behind. */
+	sent_blocks = xQueueCreate(2 * RING_DEPTH, sizeof(int16_t *));
+	assert (sent_blocks);
+
+	i2s_event_callbacks_t callbacks = {
+		.on_sent = on_sent,
+	};
+
+	ESP_ERROR_CHECK(i2s_channel_register_event_callback(snd, &callbacks, NULL));
+#else
+	ESP_LOGI(tag, "Render ahead %i blocks of %i samples...", RING_DEPTH, BUFFER_SIZE);
+	free_blocks = xQueueCreate(RING_DEPTH, sizeof(int));
+	full_blocks = xQueueCreate(RING_DEPTH, sizeof(int));
+	assert (free_blocks && full_blocks);
+
+	for (int i = 0; i < RING_DEPTH; i++)
+		xQueueSend(free_blocks, &i, 0);
+
+	i2s_event_callbacks_t callbacks = {
+		.on_send_q_ovf = on_send_q_ovf,
+	};
+
+	ESP_ERROR_CHECK(i2s_channel_register_event_callback(snd, &callbacks, NULL));
+#endif
+
+	report_latency();
+
+#if CONFIG_AUDIO_ZERO_COPY
+	/* Stay with the I2S interrupt, so that we never race the driver
+	 * clearing the buffer it has just handed over. */
+	int core = xPortGetCoreID();
+
+# if CONFIG_SYNTH_DUAL_CORE
+	if (core == VOICE_HELPER_CORE)
+		ESP_LOGW(tag, "Rendering on core %i next to the voice helper, voices will not "
+		              "render in parallel", core);
+# endif
+#elif CONFIG_SYNTH_DUAL_CORE
+	/* Keep away from the voice render helper. */
+	int core = !VOICE_HELPER_CORE;
+#else
+	int core = tskNO_AFFINITY;
+#endif
+
+	ESP_LOGI(tag, "Start the playback tasks...");
+#if !CONFIG_AUDIO_ZERO_COPY
+	xTaskCreate(write_task, "audio-write", 4096, NULL, 2, NULL);
+#endif
+	xTaskCreatePinnedToCore(render_task, "audio-render", 4096, NULL, 1, NULL, core);
+}
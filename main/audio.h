@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * Audio output.
+ *
+ * A render task fills a ring of <CONFIG_AUDIO_RING_DEPTH> blocks ahead of
+ * time and a writer task drains it into I2S. A block that takes longer
+ * than usual to render eats into the reserve instead of the DMA.
+ */
+
+
+/* (global) Default volume.
+ * Multiple tones can combine and exceed even the maximum volume. */
+extern float volume;
+
+/* Quiet mode. Depends on the position of the power switch. */
+extern bool quiet;
+
+
+/* Render time histogram buckets, each a tenth of the block period. */
+#define AUDIO_HIST_BUCKETS 10
+
+struct audio_stats {
+	/* Blocks written to I2S. */
+	unsigned blocks;
+
+	/* Blocks the writer had to wait for. */
+	unsigned underruns;
+
+	/* Fewest blocks ready at a write and sum to average them. */
+	unsigned min_fill, fill_sum;
+
+	/* Blocks rendered, including silent ones. */
+	unsigned rendered;
+
+	/* How long rendering took, relative to the block period. */
+	unsigned hist[AUDIO_HIST_BUCKETS];
+
+	/* Blocks that took longer than their own period to render. */
+	unsigned deadline_misses;
+
+	/* Longest and total render time in CPU cycles. */
+	uint32_t max_cycles;
+	uint64_t sum_cycles;
+
+	/* Times the I2S driver ran out of data. */
+	unsigned i2s_overflows;
+
+	/*
+	 * Key events timed until the block holding them was played out,
+	 * longest and total time in microseconds. Zero-copy mode only.
+	 */
+	unsigned probes;
+	uint32_t max_probe_us;
+	uint64_t sum_probe_us;
+};
+
+
+/* Configure I2S and start rendering with the current instrument. */
+void audio_init(void);
+
+/* Copy statistics since the last reset. */
+void audio_get_stats(struct audio_stats *stats);
+void audio_reset_stats(void);
+
+/* Register the "audio" console command to print and reset statistics. */
+void audio_register_commands(void);
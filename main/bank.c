@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "bank.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char *tag = "bank";
+
+
+/* Partition subtype reserved for the sample bank. */
+#define BANK_PARTITION_SUBTYPE 0x40
+
+
+static esp_partition_mmap_handle_t handle;
+static const uint8_t *base;
+static const struct bank_header *header;
+static const struct bank_entry *entries;
+
+
+/* Bytes taken by <length> samples in the given format. */
+static size_t bank_bytes(int format, size_t length)
+{
+	switch (format) {
+	case BANK_PCM16:
+		return 2 * length;
+
+	case BANK_ADPCM:
+		return (length + ADPCM_BLOCK - 1) / ADPCM_BLOCK * ADPCM_BLOCK_BYTES;
+
+	case BANK_ULAW:
+		return length;
+
+	default:
+		ESP_LOGE(tag, "Unknown sample format %i", format);
+		abort();
+	}
+}
+
+
+void bank_init(void)
+{
+	const esp_partition_t *part;
+	part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+	                                (esp_partition_subtype_t)BANK_PARTITION_SUBTYPE,
+	                                "storage");
+	assert (NULL != part);
+
+	/* Map only as much as the bank occupies. */
+	struct bank_header hdr;
+	ESP_ERROR_CHECK(esp_partition_read(part, 0, &hdr, sizeof(hdr)));
+
+	if (memcmp(hdr.magic, BANK_MAGIC, 4) || BANK_VERSION != hdr.version) {
+		ESP_LOGE(tag, "No sample bank in the storage partition");
+		abort();
+	}
+
+	if (hdr.size > part->size || sizeof(hdr) + hdr.count * sizeof(*entries) > hdr.size) {
+		ESP_LOGE(tag, "Sample bank does not fit the partition");
+		abort();
+	}
+
+	const void *ptr;
+	ESP_ERROR_CHECK(esp_partition_mmap(part, 0, hdr.size, ESP_PARTITION_MMAP_DATA,
+	                                   &ptr, &handle));
+	base = ptr;
+	header = ptr;
+	entries = (const void *)(base + sizeof(*header));
+
+	/* Make sure that we have not been flashed only partially. */
+	uint32_t crc = esp_rom_crc32_le(0, base + sizeof(*header),
+	                                header->size - sizeof(*header));
+
+	if (crc != header->crc) {
+		ESP_LOGE(tag, "Sample bank is corrupted (crc %08x, expected %08x)",
+		         (unsigned)crc, (unsigned)header->crc);
+		abort();
+	}
+
+	size_t samples = 0;
+
+	for (int i = 0; i < header->count; i++) {
+		const struct bank_entry *e = &entries[i];
+		assert (e->offset + e->size <= header->size);
+		assert (e->size >= bank_bytes(e->format, e->length));
+		assert (!e->loop_end || (e->loop_start < e->loop_end &&
+		                         e->loop_end <= e->length));
+		samples += e->length;
+	}
+
+	codec_init();
+
+	ESP_LOGI(tag, "Sample bank: %i samples at %i Hz, %u KiB, %u KiB as pcm16",
+	         header->count, (int)header->rate, (unsigned)(header->size / 1024),
+	         (unsigned)(samples * 2 / 1024));
+}
+
+
+int bank_count(void)
+{
+	return header->count;
+}
+
+
+int bank_rate(void)
+{
+	return header->rate;
+}
+
+
+int bank_find(const char *name)
+{
+	for (int i = 0; i < header->count; i++)
+		if (!strncmp(entries[i].name, name, BANK_NAME_MAX))
+			return i;
+
+	return -1;
+}
+
+
+size_t bank_length(int index)
+{
+	assert (index >= 0 && index < header->count);
+	return entries[index].length;
+}
+
+
+bool bank_loop(int index, size_t *start, size_t *end)
+{
+	assert (index >= 0 && index < header->count);
+
+	const struct bank_entry *e = &entries[index];
+
+	*start = e->loop_start;
+	*end = e->loop_end;
+
+	return e->loop_end > 0;
+}
+
+
+void bank_open(struct bank_stream *st, int index)
+{
+	assert (index >= 0 && index < header->count);
+
+	const struct bank_entry *e = &entries[index];
+
+	st->data = base + e->offset;
+	st->length = e->length;
+	st->format = e->format;
+	st->pos = 0;
+}
+
+
+void bank_seek(struct bank_stream *st, size_t pos)
+{
+	assert (pos <= st->length);
+
+	if (BANK_ADPCM == st->format && pos % ADPCM_BLOCK) {
+		/* Decode from the start of the block to catch up. */
+		size_t block = pos / ADPCM_BLOCK;
+		const uint8_t *data = st->data + block * ADPCM_BLOCK_BYTES;
+
+		adpcm_begin(&st->adpcm, data);
+		adpcm_decode(&st->adpcm, data, 0, NULL, pos % ADPCM_BLOCK);
+	}
+
+	st->pos = pos;
+}
+
+
+size_t bank_read(struct bank_stream *st, int16_t *out, size_t len)
+{
+	size_t left = st->length - st->pos;
+	len = len < left ? len : left;
+
+	switch (st->format) {
+	case BANK_PCM16:
+		memcpy(out, st->data + 2 * st->pos, 2 * len);
+		break;
+
+	case BANK_ULAW:
+		ulaw_decode(st->data + st->pos, out, len);
+		break;
+
+	case BANK_ADPCM:
+		for (size_t done = 0; done < len; ) {
+			size_t pos = st->pos + done;
+			size_t first = pos % ADPCM_BLOCK;
+			size_t n = ADPCM_BLOCK - first;
+			const uint8_t *block = st->data + pos / ADPCM_BLOCK * ADPCM_BLOCK_BYTES;
+
+			n = n < len - done ? n : len - done;
+
+			if (0 == first)
+				adpcm_begin(&st->adpcm, block);
+
+			adpcm_decode(&st->adpcm, block, first, out + done, n);
+			done += n;
+		}
+		break;
+	}
+
+	st->pos += len;
+	return len;
+}
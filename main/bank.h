@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "codec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * Sample bank in the storage partition, built by tools/mkbank.py.
+ *
+ * All samples share the bank rate and are mono. They are stored either
+ * as 16-bit PCM, 4-bit IMA-ADPCM or 8-bit µ-law and decoded while being
+ * streamed from the memory-mapped flash.
+ */
+
+#define BANK_MAGIC "ZBNK"
+#define BANK_VERSION 3
+
+enum bank_format {
+	BANK_PCM16 = 0,
+	BANK_ADPCM = 1,
+	BANK_ULAW = 2,
+};
+
+/* Longest sample name, including the terminating zero. */
+#define BANK_NAME_MAX 16
+
+struct bank_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t count;
+	uint32_t rate;
+
+	/* Length of the whole bank and CRC-32 of everything after the header. */
+	uint32_t size;
+	uint32_t crc;
+} __attribute__((__packed__));
+
+struct bank_entry {
+	char name[BANK_NAME_MAX];
+
+	/* Offset from the start of the bank and size in bytes. */
+	uint32_t offset;
+	uint32_t size;
+
+	/* Length in samples and how they are stored. */
+	uint32_t length;
+
+	/*
+	 * Samples [loop_start, loop_end) repeat while the key is held,
+	 * the rest is played after it is released. Zero loop_end means
+	 * the sample does not loop.
+	 */
+	uint32_t loop_start;
+	uint32_t loop_end;
+
+	uint8_t format;
+	uint8_t reserved[3];
+} __attribute__((__packed__));
+
+/* Reading position in a sample. */
+struct bank_stream {
+	const uint8_t *data;
+	size_t length;
+	uint8_t format;
+
+	size_t pos;
+	struct adpcm_state adpcm;
+};
+
+
+/* Map the bank from the storage partition and verify it. */
+void bank_init(void);
+
+/* Number of samples in the bank. */
+int bank_count(void);
+
+/* Sample rate of all the samples. */
+int bank_rate(void);
+
+/* Find a sample by its name. Returns its index or -1 if there is none. */
+int bank_find(const char *name);
+
+/* Length of the sample at <index> in samples. */
+size_t bank_length(int index);
+
+/*
+ * Get the loop of the sample at <index>.
+ * Returns false if the sample does not loop.
+ */
+bool bank_loop(int index, size_t *start, size_t *end);
+
+/* Start reading the sample at <index> from its beginning. */
+void bank_open(struct bank_stream *st, int index);
+
+/* Move to sample <pos>. Cheapest at the start of an ADPCM block. */
+void bank_seek(struct bank_stream *st, size_t pos);
+
+/*
+ * Decode up to <len> samples to <out> and return how many there were,
+ * which is less only at the end of the sample.
+ */
+size_t bank_read(struct bank_stream *st, int16_t *out, size_t len);
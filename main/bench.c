@@ -0,0 +1,887 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "bench.h"
+#include "synth.h"
+#include "strings.h"
+#include "upsample.h"
+#include "resample.h"
+#include "bank.h"
+#include "codec.h"
+#include "dsp.h"
+#include "limiter.h"
+
+#include "config.h"
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char *tag = "bench";
+
+
+/* One block of audio at the synthesis rate, same as the playback task uses. */
+#define BENCH_BLOCK SYNTH_BLOCK
+
+/* Same block at the output rate. */
+#define BENCH_OUT_BLOCK CONFIG_AUDIO_BLOCK_SIZE
+
+/* How many blocks to render for every measurement. */
+#define BENCH_ROUNDS 100
+
+/* Largest acceptable difference from the reference, relative to peak. */
+#define BENCH_TOLERANCE 0.02f
+
+/* Longest decay to follow in seconds and how far off it may be, relative. */
+#define BENCH_DECAY_MAX 60
+#define BENCH_DECAY_TOLERANCE 0.25f
+
+static float out_ref[BENCH_BLOCK];
+static synth_mix_t out_new[BENCH_BLOCK];
+
+/* Same noise for every run. */
+static synth_rng_t rng = 1;
+
+static float buffer_ref[STRINGS_MAX_DELAY];
+static synth_sample_t buffer_new[STRINGS_MAX_DELAY];
+
+
+/* Float string as originally implemented, independent of the build. */
+struct ref_string {
+	size_t delay, offset;
+	float cur_decay, cur_feedback;
+	float frac, frac_in, frac_out;
+	float *buffer;
+};
+
+
+inline static int wrap(int a, int max_)
+{
+	return (a + max_) % max_;
+}
+
+
+/*
+ * The original per-sample renderer, kept as a reference.
+ * It wraps every tap with a modulo and rounds samples through an int.
+ * Only the fractional delay allpass has been added since, and the option
+ * to skip the rounding, which would cut the decay short.
+ */
+static void ref_string_read(struct ref_string *ss, float *out, size_t len, bool round)
+{
+	float fb = ss->cur_feedback;
+	float nfb = (1.0 - ss->cur_feedback) * 0.5;
+
+	int offset = ss->offset;
+	int delay = ss->delay;
+
+	float decay = 1.0 - (1.0 - ss->cur_decay) * delay * 440.0 / SYNTH_FREQ;
+
+	for (int i = 0; i < len; i++) {
+		int this = wrap(offset + i, delay);
+		int next = wrap(this + 1, delay);
+
+		float this_sample = ss->buffer[this];
+		float prev_sample = ss->frac_in;
+		float next_sample = ss->buffer[next];
+
+		out[i] += this_sample;
+
+		float new = this_sample * fb
+		          + prev_sample * nfb
+		          + next_sample * nfb;
+
+		if (round)
+			new = (int)new;
+
+		float tuned = ss->frac * (new * decay - ss->frac_out) + ss->frac_in;
+
+		ss->frac_in = new * decay;
+		ss->frac_out = tuned;
+		ss->buffer[this] = tuned;
+	}
+
+	ss->offset = wrap(offset + len, delay);
+}
+
+
+/* Pluck a string and a float reference copy with identical noise. */
+static void pluck_pair(const struct synth_string *proto,
+                       struct ref_string *a, struct synth_string *b)
+{
+	*b = *proto;
+	b->buffer = buffer_new;
+	synth_string_pluck(b, &rng);
+
+	a->delay = b->delay;
+	a->offset = b->offset;
+	a->cur_decay = b->cur_decay;
+	a->cur_feedback = b->cur_feedback;
+	a->buffer = buffer_ref;
+
+#if CONFIG_SYNTH_FIXED_POINT
+	a->frac = b->frac / 32768.0f;
+#else
+	a->frac = b->frac;
+#endif
+	a->frac_in = b->frac_in;
+	a->frac_out = b->frac_out;
+
+	for (int i = 0; i < a->delay; i++)
+		a->buffer[i] = b->buffer[i];
+}
+
+
+static void bench_string(const char *name, const struct synth_string *proto)
+{
+	struct ref_string a;
+	struct synth_string b;
+
+	/* Compare the outputs first. */
+	pluck_pair(proto, &a, &b);
+
+	float max_diff = 0, peak = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		memset(out_ref, 0, sizeof(out_ref));
+		memset(out_new, 0, sizeof(out_new));
+
+		ref_string_read(&a, out_ref, BENCH_BLOCK, true);
+		synth_string_read(&b, out_new, BENCH_BLOCK);
+
+		for (int i = 0; i < BENCH_BLOCK; i++) {
+			max_diff = fmaxf(max_diff, fabsf(out_ref[i] - (float)out_new[i]));
+			peak = fmaxf(peak, fabsf(out_ref[i]));
+		}
+	}
+
+	/* Then time both of them from a fresh pluck. */
+	pluck_pair(proto, &a, &b);
+
+	uint32_t start = esp_cpu_get_cycle_count();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		ref_string_read(&a, out_ref, BENCH_BLOCK, true);
+
+	uint32_t mid = esp_cpu_get_cycle_count();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		synth_string_read(&b, out_new, BENCH_BLOCK);
+
+	uint32_t end = esp_cpu_get_cycle_count();
+
+	float samples = BENCH_ROUNDS * BENCH_BLOCK;
+
+	ESP_LOGI(tag, "String %s (delay %u): ref %.2f, new %.2f cycles/sample",
+	         name, (unsigned)proto->delay,
+	         (mid - start) / samples, (end - mid) / samples);
+
+	float rel_diff = max_diff / fmaxf(peak, 1.0f);
+
+	if (rel_diff > BENCH_TOLERANCE) {
+		ESP_LOGW(tag, "String %s: max difference %.1f of peak %.1f (%.3f%%) out of tolerance",
+		         name, max_diff, peak, 100.0f * rel_diff);
+	} else {
+		ESP_LOGI(tag, "String %s: max difference %.1f of peak %.1f (%.3f%%)",
+		         name, max_diff, peak, 100.0f * rel_diff);
+	}
+}
+
+
+/*
+ * Follow a string until it falls silent and compare how long that took
+ * with the unrounded float reference. Small errors that do not show in
+ * the first blocks add up over the whole decay.
+ */
+static void bench_decay(const char *name, const struct synth_string *proto)
+{
+	struct ref_string a;
+	struct synth_string b;
+
+	pluck_pair(proto, &a, &b);
+
+	size_t limit = BENCH_DECAY_MAX * SYNTH_FREQ;
+	size_t ref_len = 0, new_len = 0;
+
+	/* Reference peak over whole passes of the loop, like the strings do. */
+	float pass_peak = 0;
+	size_t pass = 0;
+
+	for (size_t t = BENCH_BLOCK; t <= limit && !(ref_len && new_len); t += BENCH_BLOCK) {
+		if (!ref_len) {
+			memset(out_ref, 0, sizeof(out_ref));
+			ref_string_read(&a, out_ref, BENCH_BLOCK, false);
+
+			for (int i = 0; i < BENCH_BLOCK; i++)
+				pass_peak = fmaxf(pass_peak, fabsf(out_ref[i]));
+
+			pass += BENCH_BLOCK;
+
+			if (pass >= a.delay) {
+				if (pass_peak <= SYNTH_SILENCE)
+					ref_len = t;
+
+				pass_peak = 0;
+				pass = 0;
+			}
+		}
+
+		if (!new_len) {
+			synth_string_read(&b, out_new, BENCH_BLOCK);
+
+			if (!b.active)
+				new_len = t;
+		}
+	}
+
+	float ref_s = (float)(ref_len ? ref_len : limit) / SYNTH_FREQ;
+	float new_s = (float)(new_len ? new_len : limit) / SYNTH_FREQ;
+	float rel_diff = fabsf(new_s - ref_s) / ref_s;
+
+	if (rel_diff > BENCH_DECAY_TOLERANCE) {
+		ESP_LOGW(tag, "String %s: silent after %.2f s, reference %.2f s, out of tolerance",
+		         name, new_s, ref_s);
+	} else {
+		ESP_LOGI(tag, "String %s: silent after %.2f s, reference %.2f s",
+		         name, new_s, ref_s);
+	}
+}
+
+
+/* Rates the tuning is checked at. */
+static const int tuning_rates[] = {22050, 24000, 32000, 44100, 48000, 96000};
+
+
+/*
+ * Phase of one trip around the string loop at angular frequency w,
+ * see synth_string_tune() for the derivation. Pass c = NAN to leave
+ * the fractional delay allpass out.
+ */
+static double loop_phase(double w, size_t delay, double c, double fb, double nfb)
+{
+	double phase = atan2(nfb * sin(w), fb + nfb * cos(w))
+	             - atan2(nfb * sin(w), 1.0 - nfb * cos(w))
+	             - w * delay;
+
+	if (!isnan(c))
+		phase += atan2(-sin(w), c + cos(w)) - atan2(-c * sin(w), 1.0 + c * cos(w));
+
+	return phase;
+}
+
+
+/* Find the fundamental where the loop phase makes a full turn. */
+static double loop_pitch(double rate, double freq, size_t delay, double c, double fb, double nfb)
+{
+	double lo = 2 * M_PI * freq / rate * 0.8;
+	double hi = 2 * M_PI * freq / rate * 1.25;
+
+	for (int i = 0; i < 50; i++) {
+		double mid = (lo + hi) / 2;
+
+		if (loop_phase(mid, delay, c, fb, nfb) > -2 * M_PI)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return (lo + hi) / 2 * rate / (2 * M_PI);
+}
+
+
+static void bench_tuning_string(int rate, const struct synth_string *proto)
+{
+	struct synth_string ss = *proto;
+	synth_string_tune(&ss, rate);
+
+	/* Plain integer delay line, as the strings used to be tuned. */
+	size_t int_delay = rate / ss.freq;
+	double int_decay = 1.0 - (1.0 - ss.decay) * int_delay * 440.0 / rate;
+	double int_pitch = loop_pitch(rate, ss.freq, int_delay, NAN,
+	                              ss.feedback * int_decay,
+	                              (1.0 - ss.feedback) * 0.5 * int_decay);
+
+	double decay = 1.0 - (1.0 - ss.decay) * ss.delay * 440.0 / rate;
+#if CONFIG_SYNTH_FIXED_POINT
+	double c = ss.frac / 32768.0;
+#else
+	double c = ss.frac;
+#endif
+	double pitch = loop_pitch(rate, ss.freq, ss.delay, c,
+	                          ss.feedback * decay,
+	                          (1.0 - ss.feedback) * 0.5 * decay);
+
+	ESP_LOGI(tag, "Tuning %5i Hz, %7.2f Hz: integer %+7.2f, fractional %+5.2f cents",
+	         rate, ss.freq,
+	         1200 * log2(int_pitch / ss.freq),
+	         1200 * log2(pitch / ss.freq));
+}
+
+
+/* Cents error of every note at every rate, worked out on the target. */
+static void bench_tuning(void)
+{
+	ESP_LOGI(tag, "Check string tuning...");
+
+	for (int r = 0; r < sizeof(tuning_rates) / sizeof(*tuning_rates); r++) {
+		for (int i = 0; i < NUM_STRINGS; i++)
+			bench_tuning_string(tuning_rates[r], &strings_piano1[i]);
+
+		/* The first string of the second piano repeats the last one. */
+		for (int i = 1; i < NUM_STRINGS; i++)
+			bench_tuning_string(tuning_rates[r], &strings_piano2[i]);
+	}
+}
+
+
+/* Voices to render when comparing upsampling factors. */
+#define BENCH_VOICES 8
+
+/* Delay line long enough for the output rate. */
+#define BENCH_MAX_DELAY (CONFIG_SAMPLE_FREQ * 10000 / 2616256 + 1)
+
+static synth_sample_t voice_buffers[BENCH_VOICES][BENCH_MAX_DELAY];
+static synth_mix_t out_synth[BENCH_OUT_BLOCK];
+static synth_mix_t out_final[BENCH_OUT_BLOCK];
+
+
+static void bench_upsample(int factor)
+{
+	struct synth_string voices[BENCH_VOICES];
+	struct upsampler us;
+	size_t block = BENCH_OUT_BLOCK / factor;
+
+	if (block * factor != BENCH_OUT_BLOCK)
+		return;
+
+	upsampler_init(&us, factor);
+
+	for (int i = 0; i < BENCH_VOICES; i++) {
+		voices[i] = strings_piano1[i];
+		voices[i].buffer = voice_buffers[i];
+		synth_string_tune(&voices[i], CONFIG_SAMPLE_FREQ / factor);
+		synth_string_pluck(&voices[i], &rng);
+	}
+
+	uint32_t start = esp_cpu_get_cycle_count();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		synth_mix_t *out = factor > 1 ? out_synth : out_final;
+
+		for (int i = 0; i < block; i++)
+			out[i] = 0;
+
+		for (int i = 0; i < BENCH_VOICES; i++)
+			synth_string_read(&voices[i], out, block);
+
+		if (factor > 1)
+			upsampler_run(&us, out_synth, out_final, block);
+	}
+
+	uint32_t end = esp_cpu_get_cycle_count();
+
+	ESP_LOGI(tag, "Synthesis at %i Hz, upsampled x%i: %u cycles per block of %i voices",
+	         CONFIG_SAMPLE_FREQ / factor, factor,
+	         (unsigned)((end - start) / BENCH_ROUNDS), BENCH_VOICES);
+}
+
+
+static synth_sample_t bank_buffers[BENCH_VOICES][BENCH_MAX_DELAY];
+static struct synth_bank bank;
+
+
+static void bench_bank(void)
+{
+	struct synth_string strings[BENCH_VOICES];
+	int count = BENCH_VOICES < SYNTH_BANK_SIZE ? BENCH_VOICES : SYNTH_BANK_SIZE;
+
+	for (int i = 0; i < count; i++) {
+		struct synth_string ss = strings_piano2[i];
+
+		ss.buffer = voice_buffers[i];
+		synth_string_tune(&ss, SYNTH_FREQ);
+		synth_string_pluck(&ss, &rng);
+
+		strings[i] = ss;
+
+		/* Same excitation for the bank lane. */
+		ss.buffer = bank_buffers[i];
+		memcpy(ss.buffer, strings[i].buffer, sizeof(synth_sample_t) * ss.delay);
+		synth_bank_load(&bank, i, &ss);
+	}
+
+	uint32_t string_cycles = 0, bank_cycles = 0;
+	float diff = 0, peak = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		memset(out_synth, 0, sizeof(out_synth));
+		memset(out_final, 0, sizeof(out_final));
+
+		uint32_t start = esp_cpu_get_cycle_count();
+
+		for (int i = 0; i < count; i++)
+			synth_string_read(&strings[i], out_synth, BENCH_BLOCK);
+
+		uint32_t mid = esp_cpu_get_cycle_count();
+
+		synth_bank_read(&bank, out_final, BENCH_BLOCK);
+
+		uint32_t end = esp_cpu_get_cycle_count();
+
+		string_cycles += mid - start;
+		bank_cycles += end - mid;
+
+		for (int i = 0; i < BENCH_BLOCK; i++) {
+			if (fabsf(out_synth[i] - out_final[i]) > diff)
+				diff = fabsf(out_synth[i] - out_final[i]);
+
+			if (fabsf(out_synth[i]) > peak)
+				peak = fabsf(out_synth[i]);
+		}
+	}
+
+	ESP_LOGI(tag, "%i strings: one by one %u, bank %u cycles per block",
+	         count, (unsigned)(string_cycles / BENCH_ROUNDS),
+	         (unsigned)(bank_cycles / BENCH_ROUNDS));
+	ESP_LOGI(tag, "%i strings: max difference %.1f of peak %.1f (%.3f%%)",
+	         count, diff, peak, 100.0f * diff / peak);
+
+	if (diff > BENCH_TOLERANCE * peak)
+		ESP_LOGW(tag, "String bank differs from separate strings!");
+}
+
+
+/* Block length for the mixing kernels. */
+#define KERNEL_BLOCK 480
+
+static synth_mix_t kernel_in[KERNEL_BLOCK];
+static synth_mix_t kernel_ref[KERNEL_BLOCK];
+static synth_mix_t kernel_new[KERNEL_BLOCK];
+static int16_t kernel_in_i16[KERNEL_BLOCK];
+static int16_t kernel_ref_i16[KERNEL_BLOCK];
+static int16_t kernel_new_i16[KERNEL_BLOCK];
+static int kernel_ref_peak, kernel_new_peak;
+
+#define KERNEL_GAIN 0.375f
+
+
+/* Plain loops, the way the mixer used to do it. */
+
+static void ref_clear(void)
+{
+	for (int i = 0; i < KERNEL_BLOCK; i++)
+		kernel_ref[i] = 0;
+}
+
+static void ref_accumulate(void)
+{
+	for (int i = 0; i < KERNEL_BLOCK; i++)
+		kernel_ref[i] += kernel_in[i];
+}
+
+static void ref_accumulate_i16(void)
+{
+	for (int i = 0; i < KERNEL_BLOCK; i++)
+		kernel_ref[i] += kernel_in_i16[i];
+}
+
+static void ref_gain(void)
+{
+#if CONFIG_SYNTH_FIXED_POINT
+	int32_t gain = KERNEL_GAIN * 32768;
+
+	for (int i = 0; i < KERNEL_BLOCK; i++)
+		kernel_ref[i] = ((int64_t)kernel_ref[i] * gain) >> 15;
+#else
+	for (int i = 0; i < KERNEL_BLOCK; i++)
+		kernel_ref[i] = kernel_ref[i] * KERNEL_GAIN;
+#endif
+}
+
+static void ref_to_i16(void)
+{
+	for (int i = 0; i < KERNEL_BLOCK; i++) {
+		synth_mix_t sample = kernel_ref[i];
+
+		if (sample > INT16_MAX)
+			sample = INT16_MAX;
+		else if (sample < -INT16_MAX)
+			sample = -INT16_MAX;
+
+		kernel_ref_i16[i] = sample;
+	}
+}
+
+/* Four sources at different levels. */
+#define KERNEL_SOURCES 4
+static const float kernel_gains[KERNEL_SOURCES] = {1.0f, 0.5f, 0.25f, 0.75f};
+
+static void ref_mix(void)
+{
+	for (int i = 0; i < KERNEL_BLOCK; i++) {
+#if CONFIG_SYNTH_FIXED_POINT
+		int32_t acc = 0;
+
+		for (int v = 0; v < KERNEL_SOURCES; v++)
+			acc += ((int32_t)(kernel_gains[v] * 32768) * kernel_in_i16[i]) >> 15;
+#else
+		float acc = 0;
+
+		for (int v = 0; v < KERNEL_SOURCES; v++)
+			acc += kernel_gains[v] * kernel_in_i16[i];
+#endif
+
+		kernel_ref[i] += acc;
+	}
+}
+
+static void ref_peak(void)
+{
+	kernel_ref_peak = 0;
+
+	for (int i = 0; i < KERNEL_BLOCK; i++)
+		if (abs(kernel_in_i16[i]) > kernel_ref_peak)
+			kernel_ref_peak = abs(kernel_in_i16[i]);
+}
+
+
+/* The same through the kernels. */
+
+static void new_clear(void)
+{
+	dsp_clear(kernel_new, KERNEL_BLOCK);
+}
+
+static void new_accumulate(void)
+{
+	dsp_accumulate(kernel_new, kernel_in, KERNEL_BLOCK);
+}
+
+static void new_accumulate_i16(void)
+{
+	dsp_accumulate_i16(kernel_new, kernel_in_i16, KERNEL_BLOCK);
+}
+
+static void new_gain(void)
+{
+	dsp_gain(kernel_new, KERNEL_GAIN, KERNEL_BLOCK);
+}
+
+static void new_mix(void)
+{
+	const int16_t *in[KERNEL_SOURCES];
+
+	for (int v = 0; v < KERNEL_SOURCES; v++)
+		in[v] = kernel_in_i16;
+
+	dsp_mix_i16(kernel_new, in, kernel_gains, KERNEL_SOURCES, KERNEL_BLOCK);
+}
+
+static void new_to_i16(void)
+{
+	dsp_to_i16(kernel_new_i16, kernel_new, KERNEL_BLOCK);
+}
+
+static void new_peak(void)
+{
+	kernel_new_peak = dsp_peak_i16(kernel_in_i16, KERNEL_BLOCK);
+}
+
+
+static uint32_t time_kernel(void (*kernel)(void))
+{
+	uint32_t total = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		/* Start from the same data every round. */
+		memcpy(kernel_ref, kernel_in, sizeof(kernel_in));
+		memcpy(kernel_new, kernel_in, sizeof(kernel_in));
+
+		uint32_t start = esp_cpu_get_cycle_count();
+		kernel();
+		total += esp_cpu_get_cycle_count() - start;
+	}
+
+	return total / BENCH_ROUNDS;
+}
+
+
+static void bench_kernel(const char *name, void (*ref)(void), void (*new)(void))
+{
+	uint32_t ref_cycles = time_kernel(ref);
+	uint32_t new_cycles = time_kernel(new);
+
+	/* Both variants must agree bit for bit. */
+	memcpy(kernel_ref, kernel_in, sizeof(kernel_in));
+	memcpy(kernel_new, kernel_in, sizeof(kernel_in));
+	ref();
+	new();
+
+	bool same = !memcmp(kernel_ref, kernel_new, sizeof(kernel_ref))
+	         && !memcmp(kernel_ref_i16, kernel_new_i16, sizeof(kernel_ref_i16))
+	         && kernel_ref_peak == kernel_new_peak;
+
+	ESP_LOGI(tag, "Kernel %-14s: loop %5u, kernel %5u cycles/block (%.2fx)%s",
+	         name, (unsigned)ref_cycles, (unsigned)new_cycles,
+	         (float)ref_cycles / (new_cycles ? new_cycles : 1),
+	         same ? "" : ", MISMATCH");
+}
+
+
+/*
+ * Time every kernel against the plain loop it replaced and check that the
+ * outputs match bit for bit. Runs on the target only, with whichever
+ * kernels the build selected.
+ */
+static void bench_kernels(void)
+{
+	/* Loud enough to exercise the saturation. */
+	for (int i = 0; i < KERNEL_BLOCK; i++) {
+		kernel_in[i] = (int32_t)synth_rng_next(&rng) >> 14;
+		kernel_in_i16[i] = synth_rng_next(&rng) >> 16;
+	}
+
+	bench_kernel("clear", ref_clear, new_clear);
+	bench_kernel("accumulate", ref_accumulate, new_accumulate);
+	bench_kernel("accumulate_i16", ref_accumulate_i16, new_accumulate_i16);
+	bench_kernel("gain", ref_gain, new_gain);
+	bench_kernel("mix_i16", ref_mix, new_mix);
+	bench_kernel("to_i16", ref_to_i16, new_to_i16);
+	bench_kernel("peak_i16", ref_peak, new_peak);
+
+	ESP_LOGI(tag, "Kernel rms_i16: %.1f", dsp_rms_i16(kernel_in_i16, KERNEL_BLOCK));
+}
+
+
+/* Whole ADPCM blocks covering a synthesis block. */
+#define CODEC_BLOCKS ((BENCH_BLOCK + ADPCM_BLOCK - 1) / ADPCM_BLOCK)
+
+/* Room for the same samples in any of the formats. */
+#define CODEC_BYTES (CODEC_BLOCKS * ADPCM_BLOCK_BYTES > 2 * BENCH_BLOCK \
+                     ? CODEC_BLOCKS * ADPCM_BLOCK_BYTES : 2 * BENCH_BLOCK)
+
+static uint8_t codec_in[CODEC_BYTES];
+static int16_t codec_out[CODEC_BLOCKS * ADPCM_BLOCK];
+
+
+static void bench_codec(void)
+{
+	for (int i = 0; i < sizeof(codec_in); i++)
+		codec_in[i] = rand();
+
+	for (int b = 0; b < CODEC_BLOCKS; b++)
+		codec_in[b * ADPCM_BLOCK_BYTES + 2] %= 89;
+
+	uint32_t pcm = 0, adpcm = 0, ulaw = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		uint32_t start = esp_cpu_get_cycle_count();
+		memcpy(codec_out, codec_in, 2 * BENCH_BLOCK);
+		uint32_t mid = esp_cpu_get_cycle_count();
+
+		for (int b = 0; b < CODEC_BLOCKS; b++) {
+			struct adpcm_state st;
+			const uint8_t *block = codec_in + b * ADPCM_BLOCK_BYTES;
+			size_t left = BENCH_BLOCK - b * ADPCM_BLOCK;
+
+			adpcm_begin(&st, block);
+			adpcm_decode(&st, block, 0, codec_out + b * ADPCM_BLOCK,
+			             left < ADPCM_BLOCK ? left : ADPCM_BLOCK);
+		}
+
+		uint32_t late = esp_cpu_get_cycle_count();
+		ulaw_decode(codec_in, codec_out, BENCH_BLOCK);
+		uint32_t end = esp_cpu_get_cycle_count();
+
+		pcm += mid - start;
+		adpcm += late - mid;
+		ulaw += end - late;
+	}
+
+	pcm /= BENCH_ROUNDS;
+	adpcm /= BENCH_ROUNDS;
+	ulaw /= BENCH_ROUNDS;
+
+	ESP_LOGI(tag, "Decode %i samples in RAM: pcm16 %u, adpcm %u, ulaw %u cycles",
+	         BENCH_BLOCK, (unsigned)pcm, (unsigned)adpcm, (unsigned)ulaw);
+
+	/* Walk through the longest sample, so that the flash cache stays cold. */
+	struct bank_stream st = {0};
+
+	for (int i = 0; i < bank_count(); i++) {
+		struct bank_stream tmp;
+		bank_open(&tmp, i);
+
+		if (tmp.length > st.length)
+			st = tmp;
+	}
+
+	size_t bytes = 2 * BENCH_BLOCK;
+	size_t size = st.format == BANK_PCM16 ? 2 * st.length
+	            : st.format == BANK_ULAW ? st.length
+	            : st.length / 2;
+
+	if (size < BENCH_ROUNDS * bytes) {
+		ESP_LOGW(tag, "Sample bank too small to measure flash reads");
+		return;
+	}
+
+	uint32_t flash = 0, stream = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		uint32_t start = esp_cpu_get_cycle_count();
+		memcpy(codec_out, st.data + r * bytes, bytes);
+		uint32_t end = esp_cpu_get_cycle_count();
+		flash += end - start;
+	}
+
+	/* Same as the voices do, from the start of the sample. */
+	bank_seek(&st, 0);
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		uint32_t start = esp_cpu_get_cycle_count();
+		bank_read(&st, codec_out, BENCH_BLOCK);
+		uint32_t end = esp_cpu_get_cycle_count();
+		stream += end - start;
+	}
+
+	/* Cost of the flash reads on their own, per byte. */
+	float per_byte = (float)(flash - pcm * BENCH_ROUNDS) / (BENCH_ROUNDS * bytes);
+	per_byte = per_byte > 0 ? per_byte : 0;
+
+	unsigned adpcm_bytes = BENCH_BLOCK * ADPCM_BLOCK_BYTES / ADPCM_BLOCK;
+
+	ESP_LOGI(tag, "Flash reads: %.2f cycles per byte on top of a copy from RAM", per_byte);
+	ESP_LOGI(tag, "Per block from flash: pcm16 %u (%u B), adpcm %u (%u B), ulaw %u (%u B) cycles",
+	         (unsigned)(pcm + per_byte * 2 * BENCH_BLOCK), 2 * BENCH_BLOCK,
+	         (unsigned)(adpcm + per_byte * adpcm_bytes), adpcm_bytes,
+	         (unsigned)(ulaw + per_byte * BENCH_BLOCK), BENCH_BLOCK);
+	ESP_LOGI(tag, "Bank stream (format %i): %u cycles per block",
+	         st.format, (unsigned)(stream / BENCH_ROUNDS));
+}
+
+
+static void bench_limiter(void)
+{
+	static struct limiter lim;
+	const float threshold = INT16_MAX * 1.5f;
+
+	limiter_init(&lim, threshold, 200);
+
+	uint32_t convert = 0, limit = 0, clip = 0;
+	float over = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		/* Loud noise, well past the full scale. */
+		for (int i = 0; i < KERNEL_BLOCK; i++)
+			kernel_new[i] = kernel_in[i];
+
+		uint32_t start = esp_cpu_get_cycle_count();
+		dsp_to_i16(kernel_ref_i16, kernel_new, KERNEL_BLOCK);
+		uint32_t mid = esp_cpu_get_cycle_count();
+		limiter_run(&lim, kernel_new, KERNEL_BLOCK);
+		uint32_t late = esp_cpu_get_cycle_count();
+		limiter_clip(kernel_new_i16, kernel_new, KERNEL_BLOCK);
+		uint32_t end = esp_cpu_get_cycle_count();
+
+		convert += mid - start;
+		limit += late - mid;
+		clip += end - late;
+
+		for (int i = 0; i < KERNEL_BLOCK; i++)
+			if (fabsf(kernel_new[i]) - threshold > over)
+				over = fabsf(kernel_new[i]) - threshold;
+	}
+
+	ESP_LOGI(tag, "Saturate %u, limit %u, soft clip %u cycles per block of %i",
+	         (unsigned)(convert / BENCH_ROUNDS), (unsigned)(limit / BENCH_ROUNDS),
+	         (unsigned)(clip / BENCH_ROUNDS), KERNEL_BLOCK);
+
+	if (over > 0)
+		ESP_LOGW(tag, "Limiter overshoot by %.1f", over);
+}
+
+
+static int16_t resample_in[BENCH_BLOCK * 2 + 4];
+static int16_t resample_out[BENCH_BLOCK];
+
+
+static void bench_resample(int in_rate)
+{
+	struct resampler rs;
+
+	for (int i = 0; i < BENCH_BLOCK * 2 + 4; i++)
+		resample_in[i] = (rand() & 0xffff) - 0x8000;
+
+	resampler_init(&rs, in_rate, SYNTH_FREQ);
+
+	uint32_t start = esp_cpu_get_cycle_count();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		size_t need = resampler_need(&rs, BENCH_BLOCK);
+		resampler_run(&rs, resample_in, need, resample_out, BENCH_BLOCK);
+	}
+
+	uint32_t end = esp_cpu_get_cycle_count();
+
+	ESP_LOGI(tag, "Resample %i Hz to %i Hz: %u cycles per block",
+	         in_rate, SYNTH_FREQ, (unsigned)((end - start) / BENCH_ROUNDS));
+}
+
+
+void bench_run(void)
+{
+	bench_tuning();
+
+#if CONFIG_SYNTH_FIXED_POINT
+	ESP_LOGI(tag, "Benchmark fixed-point Karplus-Strong string renderers...");
+#else
+	ESP_LOGI(tag, "Benchmark float Karplus-Strong string renderers...");
+#endif
+	bench_string("C4", &strings_piano1[0]);
+	bench_string("C5", &strings_piano2[0]);
+	bench_string("C6", &strings_piano2[NUM_STRINGS - 1]);
+
+	bench_decay("C4", &strings_piano1[0]);
+	bench_decay("C5", &strings_piano2[0]);
+	bench_decay("C6", &strings_piano2[NUM_STRINGS - 1]);
+
+	ESP_LOGI(tag, "Benchmark string bank...");
+	bench_bank();
+
+	ESP_LOGI(tag, "Benchmark mixing kernels...");
+	bench_kernels();
+
+	ESP_LOGI(tag, "Benchmark sample decoding...");
+	bench_codec();
+
+	ESP_LOGI(tag, "Benchmark master bus limiter...");
+	bench_limiter();
+
+	ESP_LOGI(tag, "Benchmark polyphase upsampling...");
+
+	for (int factor = 1; factor <= UPSAMPLE_MAX_FACTOR; factor++)
+		bench_upsample(factor);
+
+	ESP_LOGI(tag, "Benchmark sample rate conversion...");
+	bench_resample(44100);
+	bench_resample(SYNTH_FREQ * 2);
+}
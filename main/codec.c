@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "codec.h"
+
+#include "esp_attr.h"
+
+
+static const int16_t adpcm_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t adpcm_adjust[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+/* Kept in RAM, so that decoding does not compete with the samples for cache. */
+static DRAM_ATTR int16_t ulaw_table[256];
+
+
+void codec_init(void)
+{
+	for (int i = 0; i < 256; i++) {
+		int u = ~i & 0xff;
+		int t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+		ulaw_table[i] = (u & 0x80) ? 0x84 - t : t - 0x84;
+	}
+}
+
+
+void adpcm_begin(struct adpcm_state *st, const uint8_t *block)
+{
+	st->pred = (int16_t)(block[0] | block[1] << 8);
+	st->index = block[2];
+}
+
+
+void adpcm_decode(struct adpcm_state *st, const uint8_t *block, size_t first,
+                  int16_t *out, size_t len)
+{
+	const uint8_t *codes = block + 4;
+	int pred = st->pred;
+	int index = st->index;
+
+	for (size_t i = first; i < first + len; i++) {
+		int code = (codes[i >> 1] >> ((i & 1) << 2)) & 15;
+		int step = adpcm_steps[index];
+		int diff = step >> 3;
+
+		if (code & 4)
+			diff += step;
+
+		if (code & 2)
+			diff += step >> 1;
+
+		if (code & 1)
+			diff += step >> 2;
+
+		pred += (code & 8) ? -diff : diff;
+		pred = pred < -32768 ? -32768 : pred > 32767 ? 32767 : pred;
+
+		index += adpcm_adjust[code & 7];
+		index = index < 0 ? 0 : index > 88 ? 88 : index;
+
+		if (out)
+			*out++ = pred;
+	}
+
+	st->pred = pred;
+	st->index = index;
+}
+
+
+void ulaw_decode(const uint8_t *in, int16_t *out, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		out[i] = ulaw_table[in[i]];
+}
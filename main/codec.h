@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Decoders for the compressed sample bank formats.
+ *
+ * IMA-ADPCM is stored in independent blocks, each starting with the
+ * decoder state followed by 4-bit codes, low nibble first.
+ */
+
+/* Samples in an ADPCM block and its size in bytes. */
+#define ADPCM_BLOCK 256
+#define ADPCM_BLOCK_BYTES (4 + ADPCM_BLOCK / 2)
+
+struct adpcm_state {
+	int pred;
+	int index;
+};
+
+
+/* Prepare the lookup tables. */
+void codec_init(void);
+
+/* Load decoder state from the header of an ADPCM block. */
+void adpcm_begin(struct adpcm_state *st, const uint8_t *block);
+
+/*
+ * Decode <len> samples from the codes of an ADPCM block, starting with
+ * the code at <first>. When <out> is NULL, the samples are only skipped.
+ */
+void adpcm_decode(struct adpcm_state *st, const uint8_t *block, size_t first,
+                  int16_t *out, size_t len);
+
+/* Expand 8-bit µ-law to linear samples. */
+void ulaw_decode(const uint8_t *in, int16_t *out, size_t len);
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "dsp.h"
+
+#include "config.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CONFIG_SYNTH_ESP_DSP
+# include "esp_err.h"
+# include "dsps_add.h"
+# include "dsps_mulc.h"
+#endif
+
+
+void dsp_clear(synth_mix_t *buf, size_t len)
+{
+	/* Zero bits are zero for both int32 and float. */
+	memset(buf, 0, len * sizeof(*buf));
+}
+
+
+void dsp_accumulate(synth_mix_t *out, const synth_mix_t *in, size_t len)
+{
+#if CONFIG_SYNTH_ESP_DSP
+	ESP_ERROR_CHECK(dsps_add_f32(out, in, out, len, 1, 1, 1));
+#else
+	size_t i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		out[i + 0] += in[i + 0];
+		out[i + 1] += in[i + 1];
+		out[i + 2] += in[i + 2];
+		out[i + 3] += in[i + 3];
+	}
+
+	for (; i < len; i++)
+		out[i] += in[i];
+#endif
+}
+
+
+void dsp_accumulate_i16(synth_mix_t *out, const int16_t *in, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		out[i + 0] += in[i + 0];
+		out[i + 1] += in[i + 1];
+		out[i + 2] += in[i + 2];
+		out[i + 3] += in[i + 3];
+	}
+
+	for (; i < len; i++)
+		out[i] += in[i];
+}
+
+
+#if CONFIG_SYNTH_FIXED_POINT
+void dsp_gain(synth_mix_t *buf, float gain, size_t len)
+{
+	int32_t q = gain * 32768;
+
+	for (size_t i = 0; i < len; i++)
+		buf[i] = ((int64_t)buf[i] * q) >> 15;
+}
+#else
+void dsp_gain(synth_mix_t *buf, float gain, size_t len)
+{
+# if CONFIG_SYNTH_ESP_DSP
+	ESP_ERROR_CHECK(dsps_mulc_f32(buf, buf, len, gain, 1, 1));
+# else
+	size_t i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		buf[i + 0] *= gain;
+		buf[i + 1] *= gain;
+		buf[i + 2] *= gain;
+		buf[i + 3] *= gain;
+	}
+
+	for (; i < len; i++)
+		buf[i] *= gain;
+# endif
+}
+#endif
+
+
+void dsp_mix_i16(synth_mix_t *out, const int16_t *const *in, const float *gain,
+                 int n, size_t len)
+{
+	assert (n <= DSP_MIX_MAX);
+
+	/* Four samples at a time, so that every gain is loaded just once for them. */
+#if CONFIG_SYNTH_FIXED_POINT
+	int32_t g[DSP_MIX_MAX];
+
+	for (int v = 0; v < n; v++)
+		g[v] = gain[v] * 32768;
+
+	size_t i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		int32_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+
+		for (int v = 0; v < n; v++) {
+			const int16_t *src = in[v] + i;
+
+			acc0 += (g[v] * src[0]) >> 15;
+			acc1 += (g[v] * src[1]) >> 15;
+			acc2 += (g[v] * src[2]) >> 15;
+			acc3 += (g[v] * src[3]) >> 15;
+		}
+
+		out[i + 0] += acc0;
+		out[i + 1] += acc1;
+		out[i + 2] += acc2;
+		out[i + 3] += acc3;
+	}
+
+	for (; i < len; i++) {
+		int32_t acc = 0;
+
+		for (int v = 0; v < n; v++)
+			acc += (g[v] * in[v][i]) >> 15;
+
+		out[i] += acc;
+	}
+#else
+	size_t i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		float acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+
+		for (int v = 0; v < n; v++) {
+			const int16_t *src = in[v] + i;
+			float g = gain[v];
+
+			acc0 += g * src[0];
+			acc1 += g * src[1];
+			acc2 += g * src[2];
+			acc3 += g * src[3];
+		}
+
+		out[i + 0] += acc0;
+		out[i + 1] += acc1;
+		out[i + 2] += acc2;
+		out[i + 3] += acc3;
+	}
+
+	for (; i < len; i++) {
+		float acc = 0;
+
+		for (int v = 0; v < n; v++)
+			acc += gain[v] * in[v][i];
+
+		out[i] += acc;
+	}
+#endif
+}
+
+
+void dsp_to_i16(int16_t *out, const synth_mix_t *in, size_t len)
+{
+	/*
+	 * Clamp in the mix domain before converting, so that the float
+	 * build never converts an out of range value. Conversion of what
+	 * remains truncates towards zero in both builds.
+	 */
+	for (size_t i = 0; i < len; i++) {
+		synth_mix_t sample = in[i];
+
+		if (sample > INT16_MAX)
+			sample = INT16_MAX;
+		else if (sample < -INT16_MAX)
+			sample = -INT16_MAX;
+
+		out[i] = sample;
+	}
+}
+
+
+int dsp_peak_i16(const int16_t *in, size_t len)
+{
+	int peak = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		int sample = abs(in[i]);
+
+		if (sample > peak)
+			peak = sample;
+	}
+
+	return peak;
+}
+
+
+float dsp_rms_i16(const int16_t *in, size_t len)
+{
+	if (!len)
+		return 0;
+
+	/* Exact integer sum, so that only the final root can differ. */
+	int64_t sum = 0;
+
+	for (size_t i = 0; i < len; i++)
+		sum += (int32_t)in[i] * in[i];
+
+	return sqrtf((float)sum / len);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "synth.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * Block kernels for the mixer.
+ *
+ * On target the float variants use ESP-DSP when enabled, everything else
+ * is plain C that gives the very same results on any machine.
+ */
+
+
+/* Set <len> samples to zero. */
+void dsp_clear(synth_mix_t *buf, size_t len);
+
+/* Add <in> to <out>, sample by sample. */
+void dsp_accumulate(synth_mix_t *out, const synth_mix_t *in, size_t len);
+
+/* Add 16-bit samples (typically a WAV) to <out>. */
+void dsp_accumulate_i16(synth_mix_t *out, const int16_t *in, size_t len);
+
+/* Multiply samples by <gain>. Fixed-point builds use it in Q15. */
+void dsp_gain(synth_mix_t *buf, float gain, size_t len);
+
+/* Most sources dsp_mix_i16() takes at once. */
+#define DSP_MIX_MAX 16
+
+/*
+ * Add <n> 16-bit sources, each scaled by its own gain, to <out> in
+ * a single pass. Fixed-point builds use the gains in Q15.
+ */
+void dsp_mix_i16(synth_mix_t *out, const int16_t *const *in, const float *gain,
+                 int n, size_t len);
+
+/* Convert to 16 bits, saturating both positive and negative samples. */
+void dsp_to_i16(int16_t *out, const synth_mix_t *in, size_t len);
+
+/* Largest absolute value of the samples. */
+int dsp_peak_i16(const int16_t *in, size_t len);
+
+/* Root mean square of the samples. */
+float dsp_rms_i16(const int16_t *in, size_t len);
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "event.h"
+
+#include <stdatomic.h>
+
+
+static struct event ring[EVENT_RING_SIZE];
+
+/*
+ * Free-running positions, only the producer moves head and
+ * only the consumer moves tail. Both wrap around naturally.
+ */
+static atomic_uint head, tail;
+
+
+bool event_post(const struct event *ev)
+{
+	unsigned h = atomic_load_explicit(&head, memory_order_relaxed);
+	unsigned t = atomic_load_explicit(&tail, memory_order_acquire);
+
+	if (h - t >= EVENT_RING_SIZE)
+		return false;
+
+	ring[h % EVENT_RING_SIZE] = *ev;
+
+	/* Publish the slot only after it has been filled in. */
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+	return true;
+}
+
+
+bool event_peek(struct event *ev)
+{
+	unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+	unsigned h = atomic_load_explicit(&head, memory_order_acquire);
+
+	if (h == t)
+		return false;
+
+	*ev = ring[t % EVENT_RING_SIZE];
+	return true;
+}
+
+
+bool event_take(struct event *ev)
+{
+	unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+	unsigned h = atomic_load_explicit(&head, memory_order_acquire);
+
+	if (h == t)
+		return false;
+
+	*ev = ring[t % EVENT_RING_SIZE];
+
+	/* Hand the slot back only after it has been read. */
+	atomic_store_explicit(&tail, t + 1, memory_order_release);
+	return true;
+}
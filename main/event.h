@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Slots in the ring, must be a power of two. */
+#define EVENT_RING_SIZE 64
+
+enum event_kind {
+	EVENT_KEY_PRESS,
+	EVENT_KEY_RELEASE,
+};
+
+struct instrument;
+
+/* Note event, stamped with esp_timer_get_time() when it was posted. */
+struct event {
+	struct instrument *inst;
+	int64_t time;
+	uint8_t kind;
+	uint8_t key;
+};
+
+
+/*
+ * Lock-free ring of note events.
+ *
+ * There must be a single producer (the task running the scenes) and
+ * a single consumer (the audio task), neither of them ever blocks.
+ */
+
+/* Post an event. Returns false when the ring is full. */
+bool event_post(const struct event *ev);
+
+/* Look at the oldest event without taking it. */
+bool event_peek(struct event *ev);
+
+/* Take the oldest event. Returns false when there is none. */
+bool event_take(struct event *ev);
@@ -17,15 +17,29 @@
 #include "instrument.h"
 #include "registry.h"
 #include "strings.h"
+#include "voice.h"
+#include "dsp.h"
+#include "event.h"
+#include "bank.h"
+#include "sampler.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
-#include <stdio.h>
 
 
 static const char *tag = "instrument";
 
 
+static synth_rng_t piano1_rng;
+
+
+static void piano1_init(void)
+{
+	piano1_rng = synth_rng_seed(1);
+}
+
+
 static void piano1_enable(void)
 {
 }
@@ -33,26 +47,24 @@ static void piano1_enable(void)
 
 static void piano1_key_press(int key)
 {
-	synth_string_pluck(&strings_piano1[key]);
+	voice_pluck(&strings_piano1[key], &piano1_rng);
 }
 
 
 static void piano1_key_release(int key)
 {
-	synth_string_dampen(&strings_piano1[key]);
+	voice_dampen(&strings_piano1[key]);
 }
 
 
-static void piano1_read(float *out, size_t len)
+static void piano1_read(synth_mix_t *out, size_t len)
 {
-	for (int i = 0; i < NUM_NOTES; i++) {
-		synth_string_read(&strings_piano1[i], out, len);
-		synth_string_read(&strings_piano2[i], out, len);
-	}
+	voice_read(out, len);
 }
 
 
 struct instrument Piano1 = {
+	.init = piano1_init,
 	.enable = piano1_enable,
 	.key_press = piano1_key_press,
 	.key_release = piano1_key_release,
@@ -60,6 +72,15 @@ struct instrument Piano1 = {
 };
 
 
+static synth_rng_t piano2_rng;
+
+
+static void piano2_init(void)
+{
+	piano2_rng = synth_rng_seed(2);
+}
+
+
 static void piano2_enable(void)
 {
 }
@@ -67,26 +88,24 @@ static void piano2_enable(void)
 
 static void piano2_key_press(int key)
 {
-	synth_string_pluck(&strings_piano2[key]);
+	voice_pluck(&strings_piano2[key], &piano2_rng);
 }
 
 
 static void piano2_key_release(int key)
 {
-	synth_string_dampen(&strings_piano2[key]);
+	voice_dampen(&strings_piano2[key]);
 }
 
 
-static void piano2_read(float *out, size_t len)
+static void piano2_read(synth_mix_t *out, size_t len)
 {
-	for (int i = 0; i < NUM_NOTES; i++) {
-		synth_string_read(&strings_piano1[i], out, len);
-		synth_string_read(&strings_piano2[i], out, len);
-	}
+	voice_read(out, len);
 }
 
 
 struct instrument Piano2 = {
+	.init = piano2_init,
 	.enable = piano2_enable,
 	.key_press = piano2_key_press,
 	.key_release = piano2_key_release,
@@ -94,24 +113,33 @@ struct instrument Piano2 = {
 };
 
 
-static FILE *extras_fp[NUM_NOTES] = {NULL};
-
 static const char *samples[NUM_NOTES] = {
-	"/data/toilet.wav",
-	"/data/bark.wav",
-	"/data/knock.wav",
-	"/data/meow.wav",
-	"/data/cat.wav",
-	"/data/fart.wav",
-	"/data/frog.wav",
-	"/data/chainsaw.wav",
-	"/data/rooster.wav",
-	"/data/crying.wav",
-	"/data/chicken.wav",
-	"/data/glass.wav",
-	"/data/plate.wav",
+	"toilet",
+	"bark",
+	"knock",
+	"meow",
+	"cat",
+	"fart",
+	"frog",
+	"chainsaw",
+	"rooster",
+	"crying",
+	"chicken",
+	"glass",
+	"plate",
 };
 
+static int extras_ids[NUM_NOTES];
+
+
+static void extras_init(void)
+{
+	sampler_init();
+
+	for (int key = 0; key < NUM_NOTES; key++)
+		extras_ids[key] = sampler_load(samples[key]);
+}
+
 
 static void extras_enable(void)
 {
@@ -121,42 +149,24 @@ static void extras_enable(void)
 static void extras_key_press(int key)
 {
 	ESP_LOGI(tag, "Play sample %s", samples[key]);
-
-	if (NULL == extras_fp[key]) {
-		extras_fp[key] = fopen(samples[key], "rb");
-		assert (NULL != extras_fp[key]);
-	}
-
-	fseek(extras_fp[key], 44, SEEK_SET);
+	sampler_play(extras_ids[key], 1.0f, bank_rate());
 }
 
 
 static void extras_key_release(int key)
 {
+	sampler_release(extras_ids[key]);
 }
 
 
-static void extras_read(float *out, size_t len)
+static void extras_read(synth_mix_t *out, size_t len)
 {
-	for (int key = 0; key < NUM_NOTES; key++) {
-		if (NULL == extras_fp[key])
-			continue;
-
-		int16_t buf[len];
-		size_t rd = fread(buf, 2, len, extras_fp[key]);
-
-		for (int i = 0; i < rd; i++)
-			out[i] += buf[i];
-
-		if (rd < len) {
-			fclose(extras_fp[key]);
-			extras_fp[key] = NULL;
-		}
-	}
+	sampler_read(out, len);
 }
 
 
 struct instrument Extras = {
+	.init = extras_init,
 	.enable = extras_enable,
 	.key_press = extras_key_press,
 	.key_release = extras_key_release,
@@ -167,6 +177,14 @@ struct instrument Extras = {
 struct instrument *instrument = &Piano2;
 
 
+void instrument_init(void)
+{
+	Piano1.init();
+	Piano2.init();
+	Extras.init();
+}
+
+
 void instrument_select(struct instrument *inst)
 {
 	instrument = inst;
@@ -217,8 +235,60 @@ select_extras:
 }
 
 
+static void post(int kind, int key)
+{
+	struct event ev = {
+		.inst = instrument,
+		.time = esp_timer_get_time(),
+		.kind = kind,
+		.key = key,
+	};
+
+	if (!event_post(&ev))
+		ESP_LOGW(tag, "Event ring full, dropped key %i", key);
+}
+
+
+void instrument_key_press(int key)
+{
+	post(EVENT_KEY_PRESS, key);
+}
+
+
+void instrument_key_release(int key)
+{
+	post(EVENT_KEY_RELEASE, key);
+}
+
+
 void instrument_press(int key)
 {
-	instrument->key_press(key);
-	instrument->key_release(key);
+	instrument_key_press(key);
+	instrument_key_release(key);
+}
+
+
+bool instrument_peek_event(int64_t *time)
+{
+	struct event ev;
+
+	if (!event_peek(&ev))
+		return false;
+
+	*time = ev.time;
+	return true;
+}
+
+
+void instrument_dispatch(void)
+{
+	struct event ev;
+
+	if (!event_take(&ev))
+		return;
+
+	if (EVENT_KEY_PRESS == ev.kind)
+		ev.inst->key_press(ev.key);
+	else
+		ev.inst->key_release(ev.key);
 }
@@ -16,15 +16,19 @@
 
 #pragma once
 
+#include "synth.h"
+
+#include <stdint.h>
 #include <stdlib.h>
 
 #define NUM_NOTES 13
 
 struct instrument {
+	void (*init)(void);
 	void (*enable)(void);
 	void (*key_press)(int key);
 	void (*key_release)(int key);
-	void (*read)(float *out, size_t len);
+	void (*read)(synth_mix_t *out, size_t len);
 };
 
 extern struct instrument *instrument;
@@ -33,7 +37,24 @@ extern struct instrument Piano1;
 extern struct instrument Piano2;
 extern struct instrument Extras;
 
+/* Prepare all instruments. Expects the sample bank to be mapped. */
+void instrument_init(void);
+
 void instrument_select(struct instrument *inst);
 void instrument_next(void);
 
+/*
+ * Queue a key press or release for the current instrument.
+ * Only the audio task touches voices, it applies them before every block.
+ */
+void instrument_key_press(int key);
+void instrument_key_release(int key);
+
+/* Press and release right away. */
 void instrument_press(int key);
+
+/* Time of the oldest queued key event. Returns false if there is none. */
+bool instrument_peek_event(int64_t *time);
+
+/* Apply the oldest queued key event, called by the audio task. */
+void instrument_dispatch(void);
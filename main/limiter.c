@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "limiter.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+
+/* Curve is linear up to the knee, then bends towards the full scale. */
+#define KNEE (INT16_MAX * 0.5)
+
+/* Input covered by the table, everything louder ends up at full scale. */
+#define CLIP_RANGE 65536
+
+static int16_t clip_table[LIMITER_CLIP_SIZE + 1];
+
+
+static void clip_init(void)
+{
+	for (int i = 0; i <= LIMITER_CLIP_SIZE; i++) {
+		double x = (double)i * CLIP_RANGE / LIMITER_CLIP_SIZE;
+		double y = x;
+
+		if (x > KNEE)
+			y = KNEE + (INT16_MAX - KNEE) * tanh((x - KNEE) / (INT16_MAX - KNEE));
+
+		clip_table[i] = lrint(y);
+	}
+}
+
+
+void limiter_init(struct limiter *lim, float threshold, float release_ms)
+{
+	clip_init();
+
+	lim->threshold = threshold;
+	lim->gain = 1.0;
+
+	float chunks = release_ms * CONFIG_SAMPLE_FREQ / 1000.0 / LIMITER_CHUNK;
+	lim->release = expf(-1.0f / chunks);
+
+	memset(lim->delay, 0, sizeof(lim->delay));
+	lim->delay_peak = 0;
+}
+
+
+/* Gain for the next chunk, given its peak. */
+inline static float next_gain(struct limiter *lim, float peak)
+{
+	float target = peak > lim->threshold ? lim->threshold / peak : 1.0f;
+
+	/* Attack right away, release gradually. */
+	if (target < lim->gain)
+		return target;
+
+	return target + (lim->gain - target) * lim->release;
+}
+
+
+#if CONFIG_SYNTH_FIXED_POINT
+inline static void apply(synth_mix_t *out, const synth_mix_t *in, float from, float to)
+{
+	/* Ramp the gain in Q15 over the chunk. */
+	int32_t gain = from * 32768;
+	int32_t step = (int32_t)(to * 32768 - gain) / LIMITER_CHUNK;
+
+	for (int i = 0; i < LIMITER_CHUNK; i++) {
+		gain += step;
+		out[i] = ((int64_t)in[i] * gain) >> 15;
+	}
+}
+#else
+inline static void apply(synth_mix_t *out, const synth_mix_t *in, float from, float to)
+{
+	float gain = from;
+	float step = (to - from) / LIMITER_CHUNK;
+
+	for (int i = 0; i < LIMITER_CHUNK; i++) {
+		gain += step;
+		out[i] = in[i] * gain;
+	}
+}
+#endif
+
+
+void limiter_run(struct limiter *lim, synth_mix_t *buf, size_t len)
+{
+	assert (len % LIMITER_CHUNK == 0);
+
+	synth_mix_t chunk[LIMITER_CHUNK];
+
+	for (size_t pos = 0; pos < len; pos += LIMITER_CHUNK) {
+		synth_mix_t peak = 0;
+
+		for (int i = 0; i < LIMITER_CHUNK; i++) {
+			synth_mix_t level = buf[pos + i] < 0 ? -buf[pos + i] : buf[pos + i];
+
+			if (level > peak)
+				peak = level;
+		}
+
+		/*
+		 * Ramp over the delayed chunk to the gain the incoming one needs.
+		 * Neither end of the ramp may be too loud for the delayed chunk.
+		 */
+		float gain = next_gain(lim, peak > lim->delay_peak ? peak : lim->delay_peak);
+
+		memcpy(chunk, buf + pos, sizeof(chunk));
+		apply(buf + pos, lim->delay, lim->gain, gain);
+		memcpy(lim->delay, chunk, sizeof(chunk));
+
+		lim->delay_peak = peak;
+		lim->gain = gain;
+	}
+}
+
+
+void limiter_clip(int16_t *out, const synth_mix_t *in, size_t len)
+{
+	const int shift = 8;
+
+	_Static_assert(CLIP_RANGE >> 8 == LIMITER_CLIP_SIZE, "Clip table shift mismatch");
+
+	for (size_t i = 0; i < len; i++) {
+		synth_mix_t x = in[i];
+		synth_mix_t mag = x < 0 ? -x : x;
+
+		if (mag >= CLIP_RANGE) {
+			out[i] = x < 0 ? -INT16_MAX : INT16_MAX;
+			continue;
+		}
+
+		/* Interpolate between neighbouring entries. */
+		int32_t level = mag;
+		int idx = level >> shift;
+		int32_t frac = level & ((1 << shift) - 1);
+		int32_t y = clip_table[idx] + (((clip_table[idx + 1] - clip_table[idx]) * frac) >> shift);
+
+		out[i] = x < 0 ? -y : y;
+	}
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "synth.h"
+
+
+/* Samples the limiter looks ahead and the granularity of its gain. */
+#define LIMITER_CHUNK 16
+
+/* Entries of the soft clipper curve, spanning twice the full scale. */
+#define LIMITER_CLIP_SIZE 256
+
+
+/*
+ * Master bus limiter.
+ *
+ * Signal is delayed by one chunk, so that the gain can already be down
+ * when a louder chunk arrives. Peaks above <threshold> are pulled down
+ * right away, the gain then recovers slowly. What still gets through is
+ * shaped by a soft clipper that bends smoothly into the full scale.
+ */
+struct limiter {
+	/* Peak level to keep the signal under, in int16 units. */
+	float threshold;
+
+	/* How much of the remaining gain reduction is kept every chunk. */
+	float release;
+
+	/* Gain at the end of the last chunk. */
+	float gain;
+
+	/* Look-ahead delay line and its peak. */
+	synth_mix_t delay[LIMITER_CHUNK];
+	synth_mix_t delay_peak;
+};
+
+
+/* Prepare the limiter. Release time is in milliseconds. */
+void limiter_init(struct limiter *lim, float threshold, float release_ms);
+
+/* Limit <len> samples in place. Length must be a multiple of the chunk. */
+void limiter_run(struct limiter *lim, synth_mix_t *buf, size_t len);
+
+/* Soft clip into 16 bits. */
+void limiter_clip(int16_t *out, const synth_mix_t *in, size_t len);
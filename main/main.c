@@ -17,21 +17,24 @@
 #include "led.h"
 #include "scene.h"
 #include "instrument.h"
+#include "voice.h"
+#include "strings.h"
+#include "audio.h"
 #include "registry.h"
+#include "bank.h"
+#include "prefetch.h"
+#include "bench.h"
 
 #include "config.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
-#include "driver/i2s_std.h"
 #include "driver/gpio.h"
+#include "esp_console.h"
 #include "esp_log.h"
-#include "esp_random.h"
 #include "esp_pm.h"
 #include "esp_rom_sys.h"
-#include "esp_vfs.h"
-#include "esp_vfs_fat.h"
 
 #include <math.h>
 #include <stdlib.h>
@@ -40,89 +43,12 @@
 static const char *tag = "main";
 
 
-#define BUFFER_SIZE (CONFIG_SAMPLE_FREQ / 100)
-static float buffer[BUFFER_SIZE];
-static int16_t buffer_i16[BUFFER_SIZE];
-
-static i2s_chan_handle_t snd;
-
-/* Absolute maximum volume. */
-static float max_volume = INT16_MAX;
-
-/* (global) Default volume.
- * Multiple tones can combine and exceed even the maximum volume. */
-float volume = 0.25;
-
-/* Quiet mode. Depends on the position of the power switch. */
-static bool quiet = false;
-
-
 /* Keys, organized to three rows of 6 keys each. */
 #define NUM_KEYS 18
 static bool keys[NUM_KEYS] = {false};
 static bool prev_keys[NUM_KEYS] = {false};
 
 
-static void playback_task(void *arg)
-{
-	static bool enabled = false;
-	static int idle = 0;
-
-	while (true) {
-		for (int i = 0; i < BUFFER_SIZE; i++)
-			buffer[i] = 0;
-
-		/*
-		 * Add samples from all strings to the buffer.
-		 * Most are going to be zeroes.
-		 */
-		instrument->read(buffer, BUFFER_SIZE);
-
-		/* Total value of samples in the last buffer. When it hits zero,
-		 * we do not output anything but rather disable the amplifier. */
-		size_t level = 0;
-
-		/*
-		 * Our buffer is small, so we should be able to emit it whole.
-		 */
-		size_t total = BUFFER_SIZE * sizeof(int16_t);
-		size_t written = 0;
-
-		/* Take quiet setting into account. */
-		float normal_volume = volume * (quiet ? 0.5 : 1.0);
-
-		for (int i = 0; i < BUFFER_SIZE; i++) {
-			float sample = buffer[i] * normal_volume;
-
-			if (sample > max_volume)
-				sample = max_volume;
-
-			buffer_i16[i] = sample;
-			level += sample;
-		}
-
-		if (level && !enabled) {
-			ESP_LOGI(tag, "Enable audio...");
-			ESP_ERROR_CHECK(i2s_channel_enable(snd));
-			enabled = true;
-			idle = 0;
-		} else if (!level && enabled && (++idle >= 100)) {
-			ESP_LOGI(tag, "Disable audio...");
-			ESP_ERROR_CHECK(i2s_channel_disable(snd));
-			enabled = false;
-			vTaskDelay(pdMS_TO_TICKS(BUFFER_SIZE * 1000 / CONFIG_SAMPLE_FREQ));
-			continue;
-		} else if (!level && !enabled) {
-			vTaskDelay(pdMS_TO_TICKS(BUFFER_SIZE * 1000 / CONFIG_SAMPLE_FREQ));
-			continue;
-		}
-
-		ESP_ERROR_CHECK(i2s_channel_write(snd, buffer_i16, total, &written, portMAX_DELAY));
-		assert (total == written);
-	}
-}
-
-
 void app_main(void)
 {
 	ESP_LOGI(tag, "Configure power management...");
@@ -135,11 +61,12 @@ void app_main(void)
 
 	reg_init();
 
-	ESP_LOGI(tag, "Mount /data/...");
-	esp_vfs_fat_mount_config_t fatfs_conf = {
-		.max_files = 13,
-	};
-	ESP_ERROR_CHECK(esp_vfs_fat_spiflash_mount_ro("/data", "storage", &fatfs_conf));
+	bank_init();
+
+	ESP_LOGI(tag, "Initialize instruments...");
+	strings_init();
+	voice_init();
+	instrument_init();
 
 	ESP_LOGI(tag, "Configure LED...");
 	led_init(CONFIG_LED_GPIO);
@@ -195,30 +122,30 @@ void app_main(void)
 
 	ESP_ERROR_CHECK(gpio_config(&gpio_rows));
 
-	ESP_LOGI(tag, "Configure i2s output...");
-	i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
-	chan_cfg.auto_clear = true;
-	ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &snd, NULL));
-
-	i2s_std_config_t std_cfg = {
-		.clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(CONFIG_SAMPLE_FREQ),
-		.slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
-		.gpio_cfg = {
-			.mclk = I2S_GPIO_UNUSED,
-			.bclk = GPIO_NUM_33,
-			.ws = GPIO_NUM_32,
-			.dout = GPIO_NUM_25,
-			.din = I2S_GPIO_UNUSED,
-		},
-	};
+#if CONFIG_BENCHMARK
+	ESP_LOGI(tag, "Run benchmarks...");
+	bench_run();
+#endif
+
+	audio_init();
+
+#if CONFIG_CONSOLE
+	ESP_LOGI(tag, "Start serial console...");
+	esp_console_repl_t *repl = NULL;
+	esp_console_repl_config_t repl_cfg = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+	repl_cfg.prompt = "zvonecek>";
 
-	ESP_ERROR_CHECK(i2s_channel_init_std_mode(snd, &std_cfg));
+	esp_console_dev_uart_config_t uart_cfg = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+	ESP_ERROR_CHECK(esp_console_new_repl_uart(&uart_cfg, &repl_cfg, &repl));
 
-	ESP_LOGI(tag, "Seed the random number generator...");
-	srand(esp_random());
+	ESP_ERROR_CHECK(esp_console_register_help_command());
+	audio_register_commands();
+#if CONFIG_EXTRAS_PREFETCH
+	prefetch_register_commands();
+#endif
 
-	ESP_LOGI(tag, "Start the playback task...");
-	xTaskCreate(playback_task, "playback", 4096, NULL, 0, NULL);
+	ESP_ERROR_CHECK(esp_console_start_repl(repl));
+#endif
 
 	ESP_LOGI(tag, "Initialize scenes...");
 	Keyboard.on_init();
@@ -292,7 +219,7 @@ void app_main(void)
 		for (int i = 0; i < NUM_KEYS; i++)
 			prev_keys[i] = keys[i];
 
-		unsigned sleep = scene_idle(50);
+		unsigned sleep = scene_idle(CONFIG_KEY_SCAN_INTERVAL);
 		vTaskDelay(pdMS_TO_TICKS(sleep));
 	}
 }
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "prefetch.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_console.h"
+#include "esp_log.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+
+static const char *tag = "prefetch";
+
+
+#define POS_BITS 24
+#define POS_MASK ((1u << POS_BITS) - 1)
+
+#define TAG(p) ((p) >> POS_BITS)
+#define POS(p) ((p) & POS_MASK)
+
+
+static struct prefetch *streams[PREFETCH_MAX_STREAMS];
+static atomic_int num_streams;
+
+static TaskHandle_t loader;
+static struct prefetch_stats stats;
+
+
+/* Copy out of the ring, wrapping around. */
+static void ring_copy(const struct prefetch *pf, size_t pos, int16_t *out, size_t len)
+{
+	size_t idx = pos % pf->depth;
+	size_t first = len < pf->depth - idx ? len : pf->depth - idx;
+
+	memcpy(out, pf->ring + idx, first * 2);
+	memcpy(out + first, pf->ring, (len - first) * 2);
+}
+
+
+/* Decode from the bank into the ring, wrapping around. */
+static void ring_load(struct prefetch *pf, size_t pos, size_t len)
+{
+	size_t idx = pos % pf->depth;
+	size_t first = len < pf->depth - idx ? len : pf->depth - idx;
+
+	bank_read(&pf->stream, pf->ring + idx, first);
+	bank_read(&pf->stream, pf->ring, len - first);
+}
+
+
+/* Fill the stream ring as far as it goes. Returns true if it loaded anything. */
+static bool fill(struct prefetch *pf)
+{
+	unsigned t = atomic_load_explicit(&pf->tail, memory_order_acquire);
+	unsigned h = atomic_load_explicit(&pf->head, memory_order_relaxed);
+
+	/* Consumer has moved elsewhere, start over from there. */
+	if (TAG(h) != TAG(t)) {
+		int index = atomic_load_explicit(&pf->index, memory_order_relaxed);
+
+		if (index != pf->loaded) {
+			bank_open(&pf->stream, index);
+			pf->loaded = index;
+		}
+
+		h = t;
+		bank_seek(&pf->stream, POS(h));
+	}
+
+	bool copied = false;
+
+	while (POS(h) < pf->stream.length) {
+		size_t room = pf->depth - (POS(h) - POS(t));
+		size_t left = pf->stream.length - POS(h);
+		size_t len = left < PREFETCH_CHUNK ? left : PREFETCH_CHUNK;
+
+		if (room < len)
+			break;
+
+		ring_load(pf, POS(h), len);
+		h += len;
+
+		atomic_store_explicit(&pf->head, h, memory_order_release);
+		stats.chunks++;
+		copied = true;
+	}
+
+	return copied;
+}
+
+
+static void loader_task(void *arg)
+{
+	while (true) {
+		bool copied = false;
+		int count = atomic_load(&num_streams);
+
+		for (int i = 0; i < count; i++)
+			copied |= fill(streams[i]);
+
+		/* Go around again if the consumer moved on meanwhile. */
+		if (!copied)
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+}
+
+
+void prefetch_init(void)
+{
+	if (loader)
+		return;
+
+	ESP_LOGI(tag, "Start sample loader...");
+
+	/* Below the audio tasks, so that it only runs in their spare time. */
+	xTaskCreate(loader_task, "prefetch", 2048, NULL, 0, &loader);
+	assert (loader);
+}
+
+
+void prefetch_open(struct prefetch *pf, int16_t *ring, size_t depth)
+{
+	assert (depth >= PREFETCH_CHUNK);
+
+	/* Nothing to load until started. */
+	memset(&pf->stream, 0, sizeof(pf->stream));
+	pf->loaded = -1;
+	pf->length = 0;
+
+	pf->ring = ring;
+	pf->depth = depth;
+
+	atomic_init(&pf->index, -1);
+	atomic_init(&pf->head, 0);
+	atomic_init(&pf->tail, 0);
+
+	int i = atomic_load(&num_streams);
+	assert (i < PREFETCH_MAX_STREAMS);
+	streams[i] = pf;
+	atomic_store(&num_streams, i + 1);
+}
+
+
+void prefetch_start(struct prefetch *pf, int index, size_t pos)
+{
+	pf->length = bank_length(index);
+	assert (pf->length <= POS_MASK && pos <= pf->length);
+
+	/* New generation, the loader will drop whatever it had. */
+	unsigned t = atomic_load_explicit(&pf->tail, memory_order_relaxed);
+	t = (TAG(t) + 1) << POS_BITS | pos;
+
+	atomic_store_explicit(&pf->index, index, memory_order_relaxed);
+	atomic_store_explicit(&pf->tail, t, memory_order_release);
+	prefetch_wake();
+}
+
+
+size_t prefetch_read(struct prefetch *pf, int16_t *out, size_t len)
+{
+	unsigned t = atomic_load_explicit(&pf->tail, memory_order_relaxed);
+	unsigned h = atomic_load_explicit(&pf->head, memory_order_acquire);
+	size_t avail = TAG(h) == TAG(t) ? POS(h) - POS(t) : 0;
+	size_t n = len < avail ? len : avail;
+
+	ring_copy(pf, POS(t), out, n);
+	atomic_store_explicit(&pf->tail, t + n, memory_order_release);
+
+	if (n == len || POS(t) + n >= pf->length) {
+		stats.hits++;
+	} else {
+		stats.misses++;
+		stats.missing += len - n;
+	}
+
+	return n;
+}
+
+
+size_t prefetch_tell(const struct prefetch *pf)
+{
+	return POS(atomic_load_explicit(&pf->tail, memory_order_relaxed));
+}
+
+
+void prefetch_wake(void)
+{
+	if (loader)
+		xTaskNotifyGive(loader);
+}
+
+
+void prefetch_get_stats(struct prefetch_stats *out)
+{
+	*out = stats;
+}
+
+
+void prefetch_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+
+static int cmd_prefetch(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "reset")) {
+		prefetch_reset_stats();
+		printf("Prefetch statistics reset.\n");
+		return 0;
+	}
+
+	struct prefetch_stats st;
+	prefetch_get_stats(&st);
+
+	unsigned reads = st.hits + st.misses;
+
+	printf("Reads: %u hits, %u misses (%.2f%% hit rate)\n",
+	       st.hits, st.misses, reads ? 100.0f * st.hits / reads : 100.0f);
+	printf("Silenced %u samples, loaded %u chunks of %i samples\n",
+	       st.missing, st.chunks, PREFETCH_CHUNK);
+
+	return 0;
+}
+
+
+void prefetch_register_commands(void)
+{
+	const esp_console_cmd_t cmd = {
+		.command = "prefetch",
+		.help = "Print sample prefetch statistics, or reset them",
+		.hint = "[reset]",
+		.func = cmd_prefetch,
+	};
+
+	ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "bank.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Samples copied at once, unless the stream ends sooner. */
+#define PREFETCH_CHUNK 256
+
+/* Most streams the loader task can serve. */
+#define PREFETCH_MAX_STREAMS 16
+
+
+/*
+ * Stream of samples from the bank, decoded ahead of the play head into
+ * a RAM ring by a background loader task.
+ *
+ * Positions are tagged with a generation in their top 8 bits, so that
+ * the consumer can switch to another sample without waiting for the
+ * loader. There must be a single consumer per stream, which never blocks.
+ */
+struct prefetch {
+	/* Only touched by the loader, <loaded> is the sample it streams. */
+	struct bank_stream stream;
+	int loaded;
+
+	/* Sample to stream, set by the consumer with every new generation. */
+	atomic_int index;
+	size_t length;
+
+	int16_t *ring;
+	size_t depth;
+
+	/* Loaded position, moved only by the loader. */
+	atomic_uint head;
+
+	/* Consumed position, moved only by the consumer. */
+	atomic_uint tail;
+};
+
+struct prefetch_stats {
+	/* Reads satisfied in full and those that ran out of data. */
+	unsigned hits, misses;
+
+	/* Samples replaced with silence on misses. */
+	unsigned missing;
+
+	/* Chunks decoded by the loader. */
+	unsigned chunks;
+};
+
+
+/* Start the loader task. */
+void prefetch_init(void);
+
+/* Set up an idle stream buffered in <ring> of <depth> samples. */
+void prefetch_open(struct prefetch *pf, int16_t *ring, size_t depth);
+
+/* Stream the bank sample at <index>, starting with sample <pos>. */
+void prefetch_start(struct prefetch *pf, int index, size_t pos);
+
+/*
+ * Copy up to <len> samples to <out> and return how many there were.
+ * Returns less only at the end of the stream or on a miss.
+ */
+size_t prefetch_read(struct prefetch *pf, int16_t *out, size_t len);
+
+/* Position of the next sample to be read. */
+size_t prefetch_tell(const struct prefetch *pf);
+
+/* Let the loader know that there is room to fill. */
+void prefetch_wake(void);
+
+/* Copy statistics since the last reset. */
+void prefetch_get_stats(struct prefetch_stats *stats);
+void prefetch_reset_stats(void);
+
+/* Register the "prefetch" console command to print and reset statistics. */
+void prefetch_register_commands(void);
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "resample.h"
+
+#include <string.h>
+
+
+void resampler_init(struct resampler *rs, int in_rate, int out_rate)
+{
+	rs->step = (uint64_t)in_rate * RESAMPLER_ONE / out_rate;
+
+	/* Shift in three samples, so that the first output is the first input. */
+	rs->phase = 3 * RESAMPLER_ONE;
+
+	memset(rs->s, 0, sizeof(rs->s));
+}
+
+
+size_t resampler_need(const struct resampler *rs, size_t len)
+{
+	if (!len)
+		return 0;
+
+	return (rs->phase + (uint64_t)(len - 1) * rs->step) / RESAMPLER_ONE;
+}
+
+
+inline static float cubic(const int16_t *s, float t)
+{
+	float c1 = 0.5f * (s[2] - s[0]);
+	float c2 = s[0] - 2.5f * s[1] + 2.0f * s[2] - 0.5f * s[3];
+	float c3 = 0.5f * (s[3] - s[0]) + 1.5f * (s[1] - s[2]);
+
+	return ((c3 * t + c2) * t + c1) * t + s[1];
+}
+
+
+size_t resampler_run(struct resampler *rs, const int16_t *in, size_t avail,
+                     int16_t *out, size_t len)
+{
+	const float scale = 1.0f / RESAMPLER_ONE;
+	size_t used = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		while (rs->phase >= RESAMPLER_ONE) {
+			if (used == avail)
+				return i;
+
+			rs->s[0] = rs->s[1];
+			rs->s[1] = rs->s[2];
+			rs->s[2] = rs->s[3];
+			rs->s[3] = in[used++];
+			rs->phase -= RESAMPLER_ONE;
+		}
+
+		/* The curve can overshoot the samples it passes through. */
+		float y = cubic(rs->s, rs->phase * scale);
+		out[i] = y > INT16_MAX ? INT16_MAX : y < INT16_MIN ? INT16_MIN : y;
+		rs->phase += rs->step;
+	}
+
+	return len;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* Fixed-point one for the resampler position. */
+#define RESAMPLER_ONE (1 << 16)
+
+
+/*
+ * Streaming cubic resampler for 16-bit samples.
+ *
+ * Every output is a Catmull-Rom interpolation between the middle two of
+ * the last four input samples. Input is consumed as the position moves,
+ * so that any amount of it can be fed in at a time.
+ */
+struct resampler {
+	/* Input samples per output sample and position between s[1] and s[2]. */
+	uint32_t step, phase;
+
+	/* Last four input samples, oldest first. */
+	int16_t s[4];
+};
+
+
+/* Prepare to convert from <in_rate> to <out_rate>, starting from silence. */
+void resampler_init(struct resampler *rs, int in_rate, int out_rate);
+
+/* Input samples needed to produce another <len> output samples. */
+size_t resampler_need(const struct resampler *rs, size_t len);
+
+/*
+ * Write up to <len> resampled output samples to <out>, taking input from
+ * <in>. Returns how many outputs were produced, which is fewer than <len>
+ * only when the <avail> input samples run out.
+ */
+size_t resampler_run(struct resampler *rs, const int16_t *in, size_t avail,
+                     int16_t *out, size_t len);
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "sampler.h"
+#include "bank.h"
+#include "prefetch.h"
+#include "resample.h"
+#include "dsp.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char *tag = "sampler";
+
+
+/* Samples fetched at once. */
+#define SAMPLER_CHUNK 256
+
+_Static_assert(CONFIG_SAMPLER_VOICES <= DSP_MIX_MAX, "Too many sampler voices to mix");
+
+#if CONFIG_EXTRAS_PREFETCH
+/* Start of every sample, played while the loader fills the voice ring. */
+# define SAMPLER_ATTACK (2 * SYNTH_BLOCK)
+
+/* Loader must be able to top the ring up while a block is being played. */
+_Static_assert(CONFIG_EXTRAS_PREFETCH_DEPTH >= SYNTH_BLOCK + PREFETCH_CHUNK,
+               "Prefetch depth too small for the audio block");
+#endif
+
+
+struct sample {
+	int index;
+	size_t length;
+
+	/* Repeated while held, zero loop_end if the sample does not loop. */
+	size_t loop_start;
+	size_t loop_end;
+
+#if CONFIG_EXTRAS_PREFETCH
+	/* Allocated when loaded, only as long as the sample needs. */
+	const int16_t *attack;
+	size_t attack_len;
+
+	/* Played while the loader seeks back to the loop start. */
+	const int16_t *loop;
+	size_t loop_len;
+#endif
+};
+
+static struct sample samples[SAMPLER_MAX_SAMPLES];
+static int num_samples;
+
+
+struct voice {
+	const struct sample *sample;
+	bool playing;
+
+	/* Increases with every trigger, lower is older. */
+	uint32_t serial;
+
+	/* Key is still down, keep looping. */
+	bool held;
+
+	float gain;
+	bool resample;
+	struct resampler rs;
+
+	/* Position in the sample. */
+	size_t pos;
+
+#if CONFIG_EXTRAS_PREFETCH
+	/* Samples [head_start, head_start + head_len) are played from RAM. */
+	const int16_t *head;
+	size_t head_start;
+	size_t head_len;
+
+	struct prefetch pf;
+#else
+	struct bank_stream stream;
+#endif
+};
+
+static struct voice voices[CONFIG_SAMPLER_VOICES];
+static uint32_t serial = 0;
+
+#if CONFIG_EXTRAS_PREFETCH
+static int16_t rings[CONFIG_SAMPLER_VOICES][CONFIG_EXTRAS_PREFETCH_DEPTH];
+#endif
+
+/* Every voice renders its block here before they are all mixed at once. */
+static int16_t staged[CONFIG_SAMPLER_VOICES][SYNTH_BLOCK];
+
+
+void sampler_init(void)
+{
+	ESP_LOGI(tag, "Prepare %i sample voices...", CONFIG_SAMPLER_VOICES);
+
+#if CONFIG_EXTRAS_PREFETCH
+	prefetch_init();
+
+	for (int i = 0; i < CONFIG_SAMPLER_VOICES; i++)
+		prefetch_open(&voices[i].pf, rings[i], CONFIG_EXTRAS_PREFETCH_DEPTH);
+#endif
+
+	if (bank_rate() != SYNTH_FREQ)
+		ESP_LOGW(tag, "Sample bank at %i Hz, resampling to %i Hz", bank_rate(), SYNTH_FREQ);
+}
+
+
+#if CONFIG_EXTRAS_PREFETCH
+/* Keep up to <SAMPLER_ATTACK> samples from the stream position in RAM. */
+static const int16_t *load_head(struct bank_stream *st, size_t len, size_t *loaded)
+{
+	len = len < SAMPLER_ATTACK ? len : SAMPLER_ATTACK;
+	*loaded = 0;
+
+	if (!len)
+		return NULL;
+
+	int16_t *head = heap_caps_malloc(len * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+
+	if (!head) {
+		ESP_LOGE(tag, "Out of memory for %u samples kept in RAM", (unsigned)len);
+		abort();
+	}
+
+	*loaded = bank_read(st, head, len);
+	return head;
+}
+#endif
+
+
+int sampler_load(const char *name)
+{
+	int index = bank_find(name);
+
+	if (index < 0) {
+		ESP_LOGE(tag, "Sample %s is missing from the bank", name);
+		abort();
+	}
+
+	assert (num_samples < SAMPLER_MAX_SAMPLES);
+	struct sample *s = &samples[num_samples];
+
+	s->index = index;
+	s->length = bank_length(index);
+
+	if (!bank_loop(index, &s->loop_start, &s->loop_end))
+		s->loop_start = s->loop_end = 0;
+
+#if CONFIG_EXTRAS_PREFETCH
+	struct bank_stream st;
+	bank_open(&st, index);
+	s->attack = load_head(&st, s->length, &s->attack_len);
+
+	s->loop = NULL;
+	s->loop_len = 0;
+
+	if (s->loop_end) {
+		bank_seek(&st, s->loop_start);
+		s->loop = load_head(&st, s->loop_end - s->loop_start, &s->loop_len);
+	}
+#endif
+
+	return num_samples++;
+}
+
+
+void sampler_play(int id, float gain, int rate)
+{
+	assert (id >= 0 && id < num_samples);
+
+	struct voice *voice = NULL;
+
+	for (int i = 0; i < CONFIG_SAMPLER_VOICES; i++) {
+		if (!voices[i].playing) {
+			voice = &voices[i];
+			break;
+		}
+
+		if (!voice || voices[i].serial < voice->serial)
+			voice = &voices[i];
+	}
+
+	voice->sample = &samples[id];
+	voice->playing = true;
+	voice->held = true;
+	voice->serial = serial++;
+	voice->gain = gain;
+	voice->pos = 0;
+
+	voice->resample = rate != SYNTH_FREQ;
+	resampler_init(&voice->rs, rate, SYNTH_FREQ);
+
+#if CONFIG_EXTRAS_PREFETCH
+	/* Ring takes over where the attack ends. */
+	voice->head = voice->sample->attack;
+	voice->head_start = 0;
+	voice->head_len = voice->sample->attack_len;
+	prefetch_start(&voice->pf, voice->sample->index, voice->sample->attack_len);
+#else
+	bank_open(&voice->stream, voice->sample->index);
+#endif
+}
+
+
+void sampler_release(int id)
+{
+	assert (id >= 0 && id < num_samples);
+
+	struct voice *voice = NULL;
+
+	/* Let go of the latest trigger, older ones were released already. */
+	for (int i = 0; i < CONFIG_SAMPLER_VOICES; i++) {
+		struct voice *v = &voices[i];
+
+		if (!v->playing || !v->held || v->sample != &samples[id])
+			continue;
+
+		if (!voice || v->serial > voice->serial)
+			voice = v;
+	}
+
+	if (voice)
+		voice->held = false;
+}
+
+
+/* Jump from the loop end back to its start. */
+static void loop_back(struct voice *voice)
+{
+	const struct sample *s = voice->sample;
+
+	voice->pos = s->loop_start;
+
+#if CONFIG_EXTRAS_PREFETCH
+	/* Same as with the attack, ring continues after the loop head. */
+	voice->head = s->loop;
+	voice->head_start = s->loop_start;
+	voice->head_len = s->loop_len;
+	prefetch_start(&voice->pf, s->index, s->loop_start + s->loop_len);
+#else
+	bank_seek(&voice->stream, s->loop_start);
+#endif
+}
+
+
+/* Get up to <len> consecutive samples, either from RAM or decoded right from flash. */
+static size_t fetch_linear(struct voice *voice, int16_t *out, size_t len)
+{
+#if CONFIG_EXTRAS_PREFETCH
+	size_t n = 0;
+	size_t head_end = voice->head_start + voice->head_len;
+
+	if (voice->pos >= voice->head_start && voice->pos < head_end) {
+		n = head_end - voice->pos;
+		n = n < len ? n : len;
+		memcpy(out, voice->head + (voice->pos - voice->head_start), n * 2);
+	}
+
+	if (n < len)
+		n += prefetch_read(&voice->pf, out + n, len - n);
+#else
+	size_t n = bank_read(&voice->stream, out, len);
+#endif
+
+	voice->pos += n;
+	return n;
+}
+
+
+/* Get up to <len> samples to play, going around the loop while held. */
+static size_t fetch(struct voice *voice, int16_t *out, size_t len)
+{
+	size_t loop_end = voice->sample->loop_end;
+	size_t done = 0;
+
+	while (done < len) {
+		size_t want = len - done;
+		bool looping = voice->held && loop_end;
+
+		if (looping && loop_end - voice->pos < want)
+			want = loop_end - voice->pos;
+
+		size_t n = fetch_linear(voice, out + done, want);
+		done += n;
+
+		if (n < want)
+			break;
+
+		if (looping && voice->pos >= loop_end)
+			loop_back(voice);
+	}
+
+	return done;
+}
+
+
+/* Render a block of the voice, it stops at the end of the sample. */
+static void render(struct voice *voice, int16_t *out, size_t len)
+{
+	int16_t buf[SAMPLER_CHUNK];
+	size_t done = 0;
+
+	while (done < len) {
+		size_t want = len - done;
+		size_t n;
+
+		if (voice->resample) {
+			/* Stored at another rate, convert on the fly. */
+			want = resampler_need(&voice->rs, want);
+			want = want < SAMPLER_CHUNK ? want : SAMPLER_CHUNK;
+
+			n = fetch(voice, buf, want);
+			done += resampler_run(&voice->rs, buf, n, out + done, len - done);
+		} else {
+			n = fetch(voice, out + done, want);
+			done += n;
+		}
+
+		if (voice->pos >= voice->sample->length) {
+			voice->playing = false;
+			break;
+		}
+
+		/* Not loaded in time, rest of the block stays silent. */
+		if (n < want)
+			break;
+	}
+
+	memset(out + done, 0, (len - done) * 2);
+}
+
+
+void sampler_read(synth_mix_t *out, size_t len)
+{
+	const int16_t *in[CONFIG_SAMPLER_VOICES];
+	float gain[CONFIG_SAMPLER_VOICES];
+	int n = 0;
+
+	assert (len <= SYNTH_BLOCK);
+
+	for (int i = 0; i < CONFIG_SAMPLER_VOICES; i++) {
+		struct voice *voice = &voices[i];
+
+		if (!voice->playing)
+			continue;
+
+		render(voice, staged[n], len);
+		in[n] = staged[n];
+		gain[n] = voice->gain;
+		n++;
+	}
+
+	if (!n)
+		return;
+
+	dsp_mix_i16(out, in, gain, n, len);
+
+#if CONFIG_EXTRAS_PREFETCH
+	prefetch_wake();
+#endif
+}
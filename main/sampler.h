@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "synth.h"
+
+
+/*
+ * Pool of <CONFIG_SAMPLER_VOICES> voices playing samples from the bank.
+ *
+ * Every trigger takes a voice with its own position, gain and rate, so
+ * that repeated triggers overlap instead of cutting each other off. When
+ * all voices are playing, the oldest one is stolen. That caps the cost
+ * of a block no matter how fast the triggers come.
+ *
+ * Samples with a loop in the bank repeat it for as long as the voice is
+ * held and then play on past the loop end once it has been released.
+ *
+ * With CONFIG_EXTRAS_PREFETCH, the first two blocks of every loaded
+ * sample and of every loop are kept in RAM, so that a voice can start
+ * or go around its loop right away while the loader catches up with it.
+ */
+
+/* Most samples that can be loaded. */
+#define SAMPLER_MAX_SAMPLES 16
+
+
+/* Prepare the voices. */
+void sampler_init(void);
+
+/* Look up a sample in the bank and return its id for sampler_play(). */
+int sampler_load(const char *name);
+
+/* Play a loaded sample scaled by <gain>, as if it was recorded at <rate>. */
+void sampler_play(int id, float gain, int rate);
+
+/* Stop looping the most recently played voice of the sample. */
+void sampler_release(int id);
+
+/* Add samples of all playing voices to the buffer. */
+void sampler_read(synth_mix_t *out, size_t len);
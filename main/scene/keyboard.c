@@ -83,7 +83,7 @@ static bool on_key_pressed(int key)
 	idle_since = esp_timer_get_time();
 
 	if (key < NUM_NOTES) {
-		instrument->key_press(key);
+		instrument_key_press(key);
 		return true;
 	}
 
@@ -124,7 +124,7 @@ static bool on_key_pressed(int key)
 static bool on_key_released(int key)
 {
 	if (key < NUM_NOTES) {
-		instrument->key_release(key);
+		instrument_key_release(key);
 		return true;
 	}
 
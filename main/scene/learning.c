@@ -132,7 +132,7 @@ static bool on_key_pressed(int key)
 	idle_since = esp_timer_get_time();
 
 	if (key < NUM_NOTES) {
-		instrument->key_press(key);
+		instrument_key_press(key);
 
 		if (key == note_id(current_song[next_note])) {
 			advance();
@@ -183,7 +183,7 @@ static bool on_key_pressed(int key)
 static bool on_key_released(int key)
 {
 	if (key < NUM_NOTES) {
-		instrument->key_release(key);
+		instrument_key_release(key);
 		return true;
 	}
 
@@ -38,67 +38,67 @@ static const char *tag = "strings";
 
 struct synth_string strings_piano1[NUM_STRINGS] = {
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_C,
+		.freq = NOTE_C,
 		.feedback = 0.50,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_Cs,
+		.freq = NOTE_Cs,
 		.feedback = 0.55,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_D,
+		.freq = NOTE_D,
 		.feedback = 0.60,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_Ds,
+		.freq = NOTE_Ds,
 		.feedback = 0.64,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_E,
+		.freq = NOTE_E,
 		.feedback = 0.68,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_F,
+		.freq = NOTE_F,
 		.feedback = 0.70,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_Fs,
+		.freq = NOTE_Fs,
 		.feedback = 0.72,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_G,
+		.freq = NOTE_G,
 		.feedback = 0.74,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_Gs,
+		.freq = NOTE_Gs,
 		.feedback = 0.76,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_A,
+		.freq = NOTE_A,
 		.feedback = 0.78,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_As,
+		.freq = NOTE_As,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / NOTE_H,
+		.freq = NOTE_H,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_C * 2),
+		.freq = NOTE_C * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
@@ -107,70 +107,81 @@ struct synth_string strings_piano1[NUM_STRINGS] = {
 
 struct synth_string strings_piano2[NUM_STRINGS] = {
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_C * 2),
+		.freq = NOTE_C * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_Cs * 2),
+		.freq = NOTE_Cs * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_D * 2),
+		.freq = NOTE_D * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_Ds * 2),
+		.freq = NOTE_Ds * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_E * 2),
+		.freq = NOTE_E * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_F * 2),
+		.freq = NOTE_F * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_Fs * 2),
+		.freq = NOTE_Fs * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_G * 2),
+		.freq = NOTE_G * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_Gs * 2),
+		.freq = NOTE_Gs * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_A * 2),
+		.freq = NOTE_A * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_As * 2),
+		.freq = NOTE_As * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_H * 2),
+		.freq = NOTE_H * 2,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 	{
-		.delay = CONFIG_SAMPLE_FREQ / (NOTE_C * 4),
+		.freq = NOTE_C * 4,
 		.feedback = 0.80,
 		.decay = 0.999,
 	},
 };
 
 struct synth_string *strings_current = strings_piano2;
+
+
+void strings_init(void)
+{
+	for (int i = 0; i < NUM_STRINGS; i++) {
+		synth_string_tune(&strings_piano1[i], SYNTH_FREQ);
+		synth_string_tune(&strings_piano2[i], SYNTH_FREQ);
+	}
+
+	ESP_LOGI(tag, "Tuned %i strings for %i Hz", 2 * NUM_STRINGS, SYNTH_FREQ);
+}
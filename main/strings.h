@@ -20,11 +20,21 @@
 
 #define NUM_STRINGS 13
 
+/* Longest delay line any of the strings needs, the one for C4 (261.6256 Hz). */
+#define STRINGS_MAX_DELAY (SYNTH_FREQ * 10000 / 2616256 + 1)
+
 /* Currently active set of <NUM_STRINGS> strings. */
 extern struct synth_string *strings_current;
 
-/* First set of piano strings. */
+/*
+ * First set of piano strings.
+ * These only serve as templates for the voices, see voice.h.
+ */
 extern struct synth_string strings_piano1[NUM_STRINGS];
 
 /* Second set of piano strings. */
 extern struct synth_string strings_piano2[NUM_STRINGS];
+
+
+/* Tune all the strings for the synthesis rate. */
+void strings_init(void);
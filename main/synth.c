@@ -18,35 +18,163 @@
 
 #include "config.h"
 
+#include "esp_random.h"
+
+#include <assert.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+
+#if CONFIG_SYNTH_FIXED_POINT
+inline static synth_coef_t make_coef(float x)
+{
+	return x * 32768;
+}
+
+
+/*
+ * Drop the fraction, but carry it over to the next sample.
+ *
+ * Plain truncation loses up to a whole step every trip around the loop,
+ * which cuts the sustain short, and rounding to nearest lets quiet strings
+ * ring forever. With the residue carried over, the error averages out.
+ */
+inline static int32_t shift_q15(int32_t acc, synth_mix_t *err)
+{
+	acc += *err;
+
+	int32_t out = acc >> 15;
+	*err = acc - (out << 15);
+
+	return out;
+}
+
+
+inline static synth_mix_t filter(synth_mix_t this, synth_mix_t prev, synth_mix_t next,
+                                 synth_coef_t fb, synth_coef_t nfb, synth_mix_t *err)
+{
+	/* Coefficients sum to less than one, so this fits in 32 bits. */
+	return shift_q15(this * fb + (prev + next) * nfb, err);
+}
+
+
+inline static synth_mix_t allpass(synth_mix_t in, synth_mix_t *last_in,
+                                  synth_mix_t *last_out, synth_coef_t c, synth_mix_t *err)
+{
+	synth_mix_t out = shift_q15(c * (in - *last_out), err) + *last_in;
+
+	*last_in = in;
+	*last_out = out;
+
+	return out;
+}
+#else
+inline static synth_coef_t make_coef(float x)
+{
+	return x;
+}
+
+
+inline static synth_mix_t filter(synth_mix_t this, synth_mix_t prev, synth_mix_t next,
+                                 synth_coef_t fb, synth_coef_t nfb, synth_mix_t *err)
+{
+	return this * fb + (prev + next) * nfb;
+}
+
+
+inline static synth_mix_t allpass(synth_mix_t in, synth_mix_t *last_in,
+                                  synth_mix_t *last_out, synth_coef_t c, synth_mix_t *err)
+{
+	synth_mix_t out = c * (in - *last_out) + *last_in;
+
+	*last_in = in;
+	*last_out = out;
+
+	return out;
+}
+#endif
+
+
+synth_rng_t synth_rng_seed(uint32_t salt)
+{
+#if CONFIG_SYNTH_SEED
+	uint32_t seed = CONFIG_SYNTH_SEED * 2654435761u + salt;
+#else
+	uint32_t seed = esp_random();
+#endif
+
+	/* Xorshift would be stuck at zero forever. */
+	return seed ? seed : 1;
+}
 
 
-inline static float rand_sample(void)
+void synth_string_tune(struct synth_string *ss, float rate)
 {
-	float sample = (float)rand() / (float)RAND_MAX;
-	return (sample - 0.5) * 2 * INT16_MAX;
+	double w = 2 * M_PI * ss->freq / rate;
+
+	/* Leave between half and one and a half samples to the allpass. */
+	size_t delay = rate / ss->freq - 0.5;
+
+	double decay = 1.0 - (1.0 - ss->decay) * delay * 440.0 / rate;
+	double fb = ss->feedback * decay;
+	double nfb = (1.0 - ss->feedback) * 0.5 * decay;
+
+	/*
+	 * The loop filter feeds back its own previous output, which shifts
+	 * the phase a little. Account for it at the fundamental.
+	 */
+	double shift = atan2(nfb * sin(w), fb + nfb * cos(w))
+	             - atan2(nfb * sin(w), 1.0 - nfb * cos(w));
+
+	/* Fractional delay that completes a full turn of the loop. */
+	double frac = (2 * M_PI + shift) / w - delay;
+
+	ss->delay = delay;
+	ss->frac = make_coef(sin((1 - frac) * w / 2) / sin((1 + frac) * w / 2));
 }
 
 
-void synth_string_pluck(struct synth_string *ss)
+void synth_string_pluck(struct synth_string *ss, synth_rng_t *rng)
 {
 	ss->offset = 0;
+	ss->frac_in = 0;
+	ss->frac_out = 0;
+	ss->filter_err = 0;
+	ss->frac_err = 0;
 
 	ss->cur_decay = ss->decay;
 	ss->cur_feedback = ss->feedback;
 
-	if (NULL == ss->buffer)
-		ss->buffer = calloc(sizeof(float), ss->delay);
+#if CONFIG_SYNTH_EXCITATION_BANK
+	/* Copy a random stretch of a random pre-computed burst. */
+	assert (ss->delay <= SYNTH_EXCITATION_LEN);
+
+	uint32_t r = synth_rng_next(rng);
+	const int16_t *burst = synth_excitation[r % SYNTH_EXCITATION_COUNT];
+	burst += (r >> 8) % (SYNTH_EXCITATION_LEN - ss->delay + 1);
 
+# if CONFIG_SYNTH_FIXED_POINT
+	memcpy(ss->buffer, burst, sizeof(int16_t) * ss->delay);
+# else
 	for (int i = 0; i < ss->delay; i++)
-		ss->buffer[i] = rand_sample();
+		ss->buffer[i] = burst[i];
+# endif
+#else
+	for (int i = 0; i < ss->delay; i++)
+		ss->buffer[i] = (int16_t)(synth_rng_next(rng) >> 16);
+#endif
+
+	ss->peak = INT16_MAX;
+	ss->active = true;
+	ss->level = 0;
+	ss->seen = 0;
 }
 
 
-void synth_string_pluck_shortly(struct synth_string *ss)
+void synth_string_pluck_shortly(struct synth_string *ss, synth_rng_t *rng)
 {
-	synth_string_pluck(ss);
+	synth_string_pluck(ss, rng);
 	ss->cur_decay = ss->decay * 0.99;
 	ss->cur_feedback = ss->feedback;
 }
@@ -58,42 +186,307 @@ void synth_string_dampen(struct synth_string *ss)
 }
 
 
-inline static int wrap(int a, int max_)
+void synth_string_read(struct synth_string *ss, synth_mix_t *out, size_t len)
 {
-	return (a + max_) % max_;
+	if (!ss->active)
+		return;
+
+	synth_sample_t *buffer = ss->buffer;
+	size_t delay = ss->delay;
+	size_t pos = ss->offset;
+
+	float decay = 1.0 - (1.0 - ss->cur_decay) * delay * 440.0 / SYNTH_FREQ;
+
+	/* Fold the decay into the filter coefficients. */
+	synth_coef_t fb = make_coef(ss->cur_feedback * decay);
+	synth_coef_t nfb = make_coef((1.0 - ss->cur_feedback) * 0.5 * decay);
+
+	/* Allpass state, kept in registers as well. */
+	synth_coef_t frac = ss->frac;
+	synth_mix_t frac_in = ss->frac_in;
+	synth_mix_t frac_out = ss->frac_out;
+
+	/* Rounding residues, fixed-point only. */
+	synth_mix_t filter_err = ss->filter_err;
+	synth_mix_t frac_err = ss->frac_err;
+
+	/*
+	 * Neighbouring taps are carried over in registers.
+	 * The previous one is the last filter output before the allpass.
+	 */
+	synth_mix_t prev = frac_in;
+	synth_mix_t this = buffer[pos];
+	synth_mix_t peak = ss->level;
+
+	/* Short blocks keep adding to the pass until every slot went through. */
+	size_t seen = ss->seen + len;
+
+	while (len > 0) {
+		/* Walk the delay line in runs that end at the wrap point. */
+		size_t run = delay - pos < len ? delay - pos : len;
+		size_t end = pos + run;
+		size_t stop = end < delay ? end : delay - 1;
+
+		for (size_t i = pos; i < stop; i++) {
+			synth_mix_t next = buffer[i + 1];
+			synth_mix_t level = this < 0 ? -this : this;
+
+			if (level > peak)
+				peak = level;
+
+			*out++ += this;
+			prev = filter(this, prev, next, fb, nfb, &filter_err);
+			buffer[i] = allpass(prev, &frac_in, &frac_out, frac, &frac_err);
+			this = next;
+		}
+
+		if (end == delay) {
+			/* Last slot takes its next tap from the start. */
+			synth_mix_t next = buffer[0];
+			synth_mix_t level = this < 0 ? -this : this;
+
+			if (level > peak)
+				peak = level;
+
+			*out++ += this;
+			prev = filter(this, prev, next, fb, nfb, &filter_err);
+			buffer[delay - 1] = allpass(prev, &frac_in, &frac_out, frac, &frac_err);
+			this = next;
+			end = 0;
+		}
+
+		pos = end;
+		len -= run;
+	}
+
+	ss->offset = pos;
+	ss->frac_in = frac_in;
+	ss->frac_out = frac_out;
+	ss->filter_err = filter_err;
+	ss->frac_err = frac_err;
+
+	if (seen < delay) {
+		ss->level = peak;
+		ss->seen = seen;
+		return;
+	}
+
+	ss->peak = peak;
+	ss->level = 0;
+	ss->seen = 0;
+
+	if (peak <= SYNTH_SILENCE)
+		ss->active = false;
 }
 
 
-void synth_string_read(struct synth_string *ss, float *out, size_t len)
+void synth_bank_load(struct synth_bank *sb, int lane, const struct synth_string *ss)
 {
-	if (NULL == ss->buffer)
-		ss->buffer = calloc(sizeof(float), ss->delay);
+	assert (lane >= 0 && lane < SYNTH_BANK_SIZE);
+	assert (ss->delay <= UINT16_MAX);
+
+	sb->buffer[lane] = ss->buffer;
+	sb->delay[lane] = ss->delay;
+	sb->offset[lane] = ss->offset;
+	sb->cur_decay[lane] = ss->cur_decay;
+	sb->cur_feedback[lane] = ss->cur_feedback;
+	sb->frac[lane] = ss->frac;
+	sb->frac_in[lane] = ss->frac_in;
+	sb->frac_out[lane] = ss->frac_out;
+	sb->filter_err[lane] = ss->filter_err;
+	sb->frac_err[lane] = ss->frac_err;
+	sb->peak[lane] = ss->peak;
+	sb->active[lane] = ss->active;
+	sb->level[lane] = ss->level;
+	sb->seen[lane] = ss->seen;
+}
 
-	float fb = ss->cur_feedback;
-	float nfb = (1.0 - ss->cur_feedback) * 0.5;
 
-	int offset = ss->offset;
-	int delay = ss->delay;
+void synth_bank_dampen(struct synth_bank *sb, int lane)
+{
+	sb->cur_decay[lane] = sb->cur_decay[lane] * 0.99;
+}
 
-	float decay = 1.0 - (1.0 - ss->cur_decay) * delay * 440.0 / CONFIG_SAMPLE_FREQ;
 
-	for (int i = 0; i < len; i++) {
-		int this = wrap(offset + i, delay);
-		int prev = wrap(this - 1, delay);
-		int next = wrap(this + 1, delay);
+/*
+ * State of a group of lanes, copied to locals for the duration of a tile.
+ * With constant <n>, the compiler keeps most of it in registers.
+ */
+inline static void bank_render(struct synth_bank *sb, const int *lane, int n,
+                               const synth_coef_t *fb, const synth_coef_t *nfb,
+                               synth_mix_t *peak, synth_mix_t *out, size_t len)
+{
+	synth_sample_t *buffer[SYNTH_BANK_GROUP];
+	size_t delay[SYNTH_BANK_GROUP], pos[SYNTH_BANK_GROUP];
+	synth_coef_t frac[SYNTH_BANK_GROUP];
+	synth_mix_t frac_in[SYNTH_BANK_GROUP], frac_out[SYNTH_BANK_GROUP];
+	synth_mix_t filter_err[SYNTH_BANK_GROUP], frac_err[SYNTH_BANK_GROUP];
+	synth_mix_t prev[SYNTH_BANK_GROUP], this[SYNTH_BANK_GROUP];
+	synth_mix_t pk[SYNTH_BANK_GROUP];
 
-		float this_sample = ss->buffer[this];
-		float prev_sample = ss->buffer[prev];
-		float next_sample = ss->buffer[next];
+	for (int k = 0; k < n; k++) {
+		int l = lane[k];
 
-		out[i] += this_sample;
+		buffer[k] = sb->buffer[l];
+		delay[k] = sb->delay[l];
+		pos[k] = sb->offset[l];
+		frac[k] = sb->frac[l];
+		frac_in[k] = sb->frac_in[l];
+		frac_out[k] = sb->frac_out[l];
+		filter_err[k] = sb->filter_err[l];
+		frac_err[k] = sb->frac_err[l];
+		prev[k] = frac_in[k];
+		this[k] = buffer[k][pos[k]];
+		pk[k] = peak[k];
+	}
 
-		int new = this_sample * fb
-		        + prev_sample * nfb
-		        + next_sample * nfb;
+	while (len > 0) {
+		/* Run up to the nearest wrap point of any lane. */
+		size_t run = len;
 
-		ss->buffer[this] = new * decay;
+		for (int k = 0; k < n; k++)
+			if (delay[k] - pos[k] < run)
+				run = delay[k] - pos[k];
+
+		/* Nobody wraps here, the next tap simply follows. */
+		for (size_t i = 0; i < run - 1; i++) {
+			synth_mix_t sum = 0;
+
+			/* Unroll fully, so that lane state is not spilled. */
+#pragma GCC unroll 4
+			for (int k = 0; k < n; k++) {
+				synth_mix_t next = buffer[k][pos[k] + i + 1];
+				synth_mix_t level = this[k] < 0 ? -this[k] : this[k];
+
+				if (level > pk[k])
+					pk[k] = level;
+
+				sum += this[k];
+				prev[k] = filter(this[k], prev[k], next, fb[k], nfb[k], &filter_err[k]);
+				buffer[k][pos[k] + i] = allpass(prev[k], &frac_in[k], &frac_out[k], frac[k],
+				                                &frac_err[k]);
+				this[k] = next;
+			}
+
+			out[i] += sum;
+		}
+
+		/* Last sample of the run, some lanes take the next tap from the start. */
+		synth_mix_t sum = 0;
+
+#pragma GCC unroll 4
+		for (int k = 0; k < n; k++) {
+			size_t at = pos[k] + run - 1;
+			size_t after = at + 1 < delay[k] ? at + 1 : 0;
+			synth_mix_t next = buffer[k][after];
+			synth_mix_t level = this[k] < 0 ? -this[k] : this[k];
+
+			if (level > pk[k])
+				pk[k] = level;
+
+			sum += this[k];
+			prev[k] = filter(this[k], prev[k], next, fb[k], nfb[k], &filter_err[k]);
+			buffer[k][at] = allpass(prev[k], &frac_in[k], &frac_out[k], frac[k], &frac_err[k]);
+			this[k] = next;
+			pos[k] = after;
+		}
+
+		out[run - 1] += sum;
+		out += run;
+		len -= run;
 	}
 
-	ss->offset = wrap(offset + len, delay);
+	for (int k = 0; k < n; k++) {
+		int l = lane[k];
+
+		sb->offset[l] = pos[k];
+		sb->frac_in[l] = frac_in[k];
+		sb->frac_out[l] = frac_out[k];
+		sb->filter_err[l] = filter_err[k];
+		sb->frac_err[l] = frac_err[k];
+		peak[k] = pk[k];
+	}
+}
+
+
+static void bank_render_group(struct synth_bank *sb, const int *lane, int n,
+                              const synth_coef_t *fb, const synth_coef_t *nfb,
+                              synth_mix_t *peak, synth_mix_t *out, size_t len)
+{
+	/* Specialize for a full group, render leftovers one by one. */
+	if (n == SYNTH_BANK_GROUP) {
+		bank_render(sb, lane, SYNTH_BANK_GROUP, fb, nfb, peak, out, len);
+	} else {
+		for (int k = 0; k < n; k++)
+			bank_render(sb, lane + k, 1, fb + k, nfb + k, peak + k, out, len);
+	}
+}
+
+
+int synth_bank_active(const struct synth_bank *sb, int *lanes)
+{
+	int n = 0;
+
+	for (int l = 0; l < SYNTH_BANK_SIZE; l++)
+		if (sb->active[l])
+			lanes[n++] = l;
+
+	return n;
+}
+
+
+void synth_bank_read_lanes(struct synth_bank *sb, const int *lanes, int n,
+                           synth_mix_t *out, size_t len)
+{
+	synth_coef_t fb[SYNTH_BANK_SIZE], nfb[SYNTH_BANK_SIZE];
+	synth_mix_t peak[SYNTH_BANK_SIZE];
+
+	for (int k = 0; k < n; k++) {
+		int l = lanes[k];
+		float decay = 1.0 - (1.0 - sb->cur_decay[l]) * sb->delay[l] * 440.0 / SYNTH_FREQ;
+
+		/* Fold the decay into the filter coefficients. */
+		fb[k] = make_coef(sb->cur_feedback[l] * decay);
+		nfb[k] = make_coef((1.0 - sb->cur_feedback[l]) * 0.5 * decay);
+		peak[k] = sb->level[l];
+	}
+
+	for (size_t done = 0; done < len; done += SYNTH_BANK_TILE) {
+		size_t tile = len - done < SYNTH_BANK_TILE ? len - done : SYNTH_BANK_TILE;
+
+		for (int g = 0; g < n; g += SYNTH_BANK_GROUP) {
+			int width = n - g < SYNTH_BANK_GROUP ? n - g : SYNTH_BANK_GROUP;
+
+			bank_render_group(sb, lanes + g, width, fb + g, nfb + g,
+			                  peak + g, out + done, tile);
+		}
+	}
+
+	for (int k = 0; k < n; k++) {
+		int l = lanes[k];
+
+		/* Short blocks keep adding to the pass until every slot went through. */
+		sb->seen[l] += len;
+
+		if (sb->seen[l] < sb->delay[l]) {
+			sb->level[l] = peak[k];
+			continue;
+		}
+
+		sb->peak[l] = peak[k];
+		sb->level[l] = 0;
+		sb->seen[l] = 0;
+
+		if (peak[k] <= SYNTH_SILENCE)
+			sb->active[l] = false;
+	}
+}
+
+
+void synth_bank_read(struct synth_bank *sb, synth_mix_t *out, size_t len)
+{
+	int lanes[SYNTH_BANK_SIZE];
+	int n = synth_bank_active(sb, lanes);
+
+	synth_bank_read_lanes(sb, lanes, n, out, len);
 }
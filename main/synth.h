@@ -18,15 +18,150 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/* Rate the instruments render at, before upsampling to the output. */
+#define SYNTH_FREQ (CONFIG_SAMPLE_FREQ / CONFIG_SYNTH_UPSAMPLE)
+
+/* Audio block at the synthesis rate. */
+#define SYNTH_BLOCK (CONFIG_AUDIO_BLOCK_SIZE / CONFIG_SYNTH_UPSAMPLE)
+
+#if CONFIG_SYNTH_FIXED_POINT
+/* Delay lines hold int16 samples, mixing happens in int32. */
+typedef int16_t synth_sample_t;
+typedef int32_t synth_mix_t;
+
+/* Filter coefficients in Q15. */
+typedef int32_t synth_coef_t;
+#else
+typedef float synth_sample_t;
+typedef float synth_mix_t;
+typedef float synth_coef_t;
+#endif
+
+/* Xorshift32 random number generator state. Never zero. */
+typedef uint32_t synth_rng_t;
+
+inline static uint32_t synth_rng_next(synth_rng_t *rng)
+{
+	uint32_t x = *rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *rng = x;
+}
+
+/*
+ * Seed a generator.
+ *
+ * With CONFIG_SYNTH_SEED set, the seed is derived from it and the salt,
+ * so that renders are reproducible. Otherwise it comes from the hardware.
+ */
+synth_rng_t synth_rng_seed(uint32_t salt);
+
+#if CONFIG_SYNTH_EXCITATION_BANK
+/* Pre-computed noise bursts, generated by tools/mkexcite.py. */
+# define SYNTH_EXCITATION_COUNT 8
+# define SYNTH_EXCITATION_LEN 368
+extern const int16_t synth_excitation[SYNTH_EXCITATION_COUNT][SYNTH_EXCITATION_LEN];
+#endif
+
+/* Strings with peak at or below this level (in int16 units) fall silent. */
+#define SYNTH_SILENCE 1
 
 struct synth_string {
+	/* Pitch in Hz, the delay is derived from it by synth_string_tune(). */
+	float freq;
+
 	size_t delay, offset;
 	float decay, cur_decay;
 	float feedback, cur_feedback;
-	float *buffer;
+
+	/* Allpass stage providing the fractional part of the delay. */
+	synth_coef_t frac;
+	synth_mix_t frac_in, frac_out;
+
+	/* Fractions the fixed-point loop filter and allpass carry over. */
+	synth_mix_t filter_err, frac_err;
+
+	/* Delay line of at least <delay> samples, owned by the caller. */
+	synth_sample_t *buffer;
+
+	/* Peak level of the last full pass and whether the string is still audible. */
+	synth_mix_t peak;
+	bool active;
+
+	/* Loudest sample of the pass in progress and how far it got. */
+	synth_mix_t level;
+	size_t seen;
 };
 
-void synth_string_pluck(struct synth_string *ss);
-void synth_string_pluck_shortly(struct synth_string *ss);
+/*
+ * Derive integer delay and allpass coefficient for the given rate.
+ * The loop is tuned so that its fundamental lands exactly on <freq>.
+ */
+void synth_string_tune(struct synth_string *ss, float rate);
+
+void synth_string_pluck(struct synth_string *ss, synth_rng_t *rng);
+void synth_string_pluck_shortly(struct synth_string *ss, synth_rng_t *rng);
 void synth_string_dampen(struct synth_string *ss);
-void synth_string_read(struct synth_string *ss, float *out, size_t len);
+void synth_string_read(struct synth_string *ss, synth_mix_t *out, size_t len);
+
+/* Strings a bank can hold, one lane per voice. */
+#define SYNTH_BANK_SIZE CONFIG_SYNTH_VOICES
+
+/*
+ * Lanes rendered together, summed before touching the output.
+ * Two keep all their state within the sixteen float registers.
+ */
+#define SYNTH_BANK_GROUP 2
+
+/* Output samples processed before moving on to the next group. */
+#define SYNTH_BANK_TILE 64
+
+/*
+ * Strings kept as parallel arrays of their hot state.
+ *
+ * Rendering walks groups of lanes side by side, so that the mixing buffer
+ * is loaded and stored once per group instead of once per string.
+ */
+struct synth_bank {
+	synth_sample_t *buffer[SYNTH_BANK_SIZE];
+	uint16_t delay[SYNTH_BANK_SIZE];
+	uint16_t offset[SYNTH_BANK_SIZE];
+	float cur_decay[SYNTH_BANK_SIZE];
+	float cur_feedback[SYNTH_BANK_SIZE];
+	synth_coef_t frac[SYNTH_BANK_SIZE];
+	synth_mix_t frac_in[SYNTH_BANK_SIZE];
+	synth_mix_t frac_out[SYNTH_BANK_SIZE];
+	synth_mix_t filter_err[SYNTH_BANK_SIZE];
+	synth_mix_t frac_err[SYNTH_BANK_SIZE];
+	synth_mix_t peak[SYNTH_BANK_SIZE];
+	bool active[SYNTH_BANK_SIZE];
+
+	/* Loudest sample and length of the pass in progress, see synth_string. */
+	synth_mix_t level[SYNTH_BANK_SIZE];
+	uint32_t seen[SYNTH_BANK_SIZE];
+};
+
+/* Take over a (typically just plucked) string into the given lane. */
+void synth_bank_load(struct synth_bank *sb, int lane, const struct synth_string *ss);
+
+void synth_bank_dampen(struct synth_bank *sb, int lane);
+
+/* List active lanes into <lanes>, return how many there are. */
+int synth_bank_active(const struct synth_bank *sb, int *lanes);
+
+/*
+ * Add samples of the listed lanes to the buffer.
+ * Disjoint lists can be rendered concurrently into separate buffers.
+ */
+void synth_bank_read_lanes(struct synth_bank *sb, const int *lanes, int n,
+                           synth_mix_t *out, size_t len);
+
+/* Add samples of all active lanes to the buffer. */
+void synth_bank_read(struct synth_bank *sb, synth_mix_t *out, size_t len);
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "upsample.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+
+/* Passband edge relative to the input Nyquist frequency. */
+#define CUTOFF 0.9
+
+
+void upsampler_init(struct upsampler *us, int factor)
+{
+	assert (factor >= 1 && factor <= UPSAMPLE_MAX_FACTOR);
+
+	us->factor = factor;
+	memset(us->history, 0, sizeof(us->history));
+
+	int len = factor * UPSAMPLE_TAPS;
+	double proto[len];
+
+	/* Blackman windowed sinc at the input Nyquist frequency. */
+	for (int i = 0; i < len; i++) {
+		double t = (i - (len - 1) / 2.0) / factor;
+		double x = M_PI * CUTOFF * t;
+		double sinc = fabs(x) < 1e-9 ? 1.0 : sin(x) / x;
+		double w = 0.42 - 0.5 * cos(2 * M_PI * (i + 0.5) / len)
+		                + 0.08 * cos(4 * M_PI * (i + 0.5) / len);
+
+		proto[i] = sinc * w;
+	}
+
+	/* Split it into branches, each with unity gain at DC. */
+	for (int p = 0; p < factor; p++) {
+		double sum = 0;
+
+		for (int k = 0; k < UPSAMPLE_TAPS; k++)
+			sum += proto[p + k * factor];
+
+		for (int k = 0; k < UPSAMPLE_TAPS; k++) {
+#if CONFIG_SYNTH_FIXED_POINT
+			us->coef[p][k] = lrint(proto[p + k * factor] / sum * 32768);
+#else
+			us->coef[p][k] = proto[p + k * factor] / sum;
+#endif
+		}
+	}
+}
+
+
+#if CONFIG_SYNTH_FIXED_POINT
+inline static synth_mix_t branch(const synth_coef_t *coef, const synth_mix_t *x)
+{
+	/* Mixed samples may exceed 16 bits, so accumulate in 64. */
+	int64_t acc = 0;
+
+	for (int k = 0; k < UPSAMPLE_TAPS; k++)
+		acc += (int64_t)coef[k] * x[-k];
+
+	return acc >> 15;
+}
+#else
+inline static synth_mix_t branch(const synth_coef_t *coef, const synth_mix_t *x)
+{
+	synth_mix_t acc = 0;
+
+	for (int k = 0; k < UPSAMPLE_TAPS; k++)
+		acc += coef[k] * x[-k];
+
+	return acc;
+}
+#endif
+
+
+void upsampler_run(struct upsampler *us, const synth_mix_t *in, synth_mix_t *out, size_t len)
+{
+	const int hist = UPSAMPLE_TAPS - 1;
+	int factor = us->factor;
+
+	assert (len >= hist);
+
+	/* The first few outputs reach back into the previous block. */
+	synth_mix_t head[2 * UPSAMPLE_TAPS - 2];
+	memcpy(head, us->history, sizeof(us->history));
+	memcpy(head + hist, in, sizeof(*in) * hist);
+
+	for (int i = 0; i < hist; i++)
+		for (int p = 0; p < factor; p++)
+			*out++ = branch(us->coef[p], head + hist + i);
+
+	for (int i = hist; i < len; i++)
+		for (int p = 0; p < factor; p++)
+			*out++ = branch(us->coef[p], in + i);
+
+	memcpy(us->history, in + len - hist, sizeof(us->history));
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "synth.h"
+
+
+/* Largest supported upsampling factor. */
+#define UPSAMPLE_MAX_FACTOR 4
+
+/* Length of every polyphase branch. */
+#define UPSAMPLE_TAPS 8
+
+
+/*
+ * Polyphase interpolator.
+ *
+ * Instead of stuffing zeroes between input samples and running them
+ * through a long lowpass, every output phase has its own short branch
+ * of the filter that works on the input samples directly.
+ */
+struct upsampler {
+	int factor;
+
+	/* Filter branch for every output phase. */
+	synth_coef_t coef[UPSAMPLE_MAX_FACTOR][UPSAMPLE_TAPS];
+
+	/* Tail of the previous input block. */
+	synth_mix_t history[UPSAMPLE_TAPS - 1];
+};
+
+
+/* Design the filter for the given factor and clear the history. */
+void upsampler_init(struct upsampler *us, int factor);
+
+
+/*
+ * Upsample <len> input samples into <len * factor> output samples.
+ * Input blocks must be at least <UPSAMPLE_TAPS - 1> samples long.
+ */
+void upsampler_run(struct upsampler *us, const synth_mix_t *in, synth_mix_t *out, size_t len);
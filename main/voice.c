@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "voice.h"
+#include "strings.h"
+#include "dsp.h"
+
+#include "config.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+#include <stdlib.h>
+
+
+static const char *tag = "voice";
+
+
+/* Hot state of all voices, lane <i> belongs to voices[i]. */
+static struct synth_bank bank;
+
+struct voice {
+	/* Tuning of the voice, the bank takes over after the pluck. */
+	struct synth_string string;
+
+	/* Template the voice has been plucked from. */
+	const struct synth_string *proto;
+
+	/* Increases with every pluck, lower is older. */
+	uint32_t serial;
+};
+
+static struct voice voices[CONFIG_SYNTH_VOICES];
+static uint32_t serial = 0;
+
+/* Delay lines for all voices, long enough for any string. */
+static synth_sample_t arena[CONFIG_SYNTH_VOICES][STRINGS_MAX_DELAY];
+
+#if CONFIG_SYNTH_DUAL_CORE
+/*
+ * Work for the helper task on the other core.
+ * Written before it is notified and left alone until it notifies back.
+ */
+static struct {
+	const int *lanes;
+	int n;
+	size_t len;
+	TaskHandle_t caller;
+} job;
+
+static synth_mix_t partial[SYNTH_BLOCK];
+static TaskHandle_t helper;
+
+
+static void helper_task(void *arg)
+{
+	while (true) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		dsp_clear(partial, job.len);
+		synth_bank_read_lanes(&bank, job.lanes, job.n, partial, job.len);
+
+		xTaskNotifyGive(job.caller);
+	}
+}
+#endif
+
+
+void voice_init(void)
+{
+	for (int i = 0; i < CONFIG_SYNTH_VOICES; i++)
+		voices[i].string.buffer = arena[i];
+
+	ESP_LOGI(tag, "Delay line arena: %u voices, %u bytes",
+	         CONFIG_SYNTH_VOICES, (unsigned)sizeof(arena));
+
+#if CONFIG_SYNTH_DUAL_CORE
+	ESP_LOGI(tag, "Start the render helper on core %i...", VOICE_HELPER_CORE);
+	xTaskCreatePinnedToCore(helper_task, "voice-helper", 4096, NULL, 1, &helper,
+	                        VOICE_HELPER_CORE);
+#endif
+}
+
+
+static struct voice *voice_alloc(void)
+{
+	int best = 0;
+
+	for (int i = 0; i < CONFIG_SYNTH_VOICES; i++) {
+		if (!bank.active[i])
+			return &voices[i];
+
+		if (bank.peak[i] < bank.peak[best])
+			best = i;
+		else if (bank.peak[i] == bank.peak[best] && voices[i].serial < voices[best].serial)
+			best = i;
+	}
+
+	return &voices[best];
+}
+
+
+void voice_pluck(const struct synth_string *proto, synth_rng_t *rng)
+{
+	struct voice *voice = voice_alloc();
+	synth_sample_t *buffer = voice->string.buffer;
+
+	voice->string = *proto;
+	voice->string.buffer = buffer;
+	voice->proto = proto;
+	voice->serial = ++serial;
+
+	synth_string_pluck(&voice->string, rng);
+	synth_bank_load(&bank, voice - voices, &voice->string);
+}
+
+
+void voice_dampen(const struct synth_string *proto)
+{
+	int latest = -1;
+
+	for (int i = 0; i < CONFIG_SYNTH_VOICES; i++) {
+		if (voices[i].proto != proto || !bank.active[i])
+			continue;
+
+		if (latest < 0 || voices[i].serial > voices[latest].serial)
+			latest = i;
+	}
+
+	if (latest >= 0)
+		synth_bank_dampen(&bank, latest);
+}
+
+
+void voice_read(synth_mix_t *out, size_t len)
+{
+#if CONFIG_SYNTH_DUAL_CORE
+	int lanes[SYNTH_BANK_SIZE];
+	int n = synth_bank_active(&bank, lanes);
+
+	if (n < 2 || len > SYNTH_BLOCK) {
+		synth_bank_read_lanes(&bank, lanes, n, out, len);
+		return;
+	}
+
+	/*
+	 * Split the active voices in half.
+	 * The list is made once here, so that both cores agree on it.
+	 */
+	int half = n / 2;
+
+	job.lanes = lanes + half;
+	job.n = n - half;
+	job.len = len;
+	job.caller = xTaskGetCurrentTaskHandle();
+	xTaskNotifyGive(helper);
+
+	synth_bank_read_lanes(&bank, lanes, half, out, len);
+
+	/* Barrier, wait for the other half and add it. */
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	dsp_accumulate(out, partial, len);
+#else
+	synth_bank_read(&bank, out, len);
+#endif
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 Jan Hamal Dvořák <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "synth.h"
+
+
+/*
+ * Pool of <CONFIG_SYNTH_VOICES> strings shared by the pianos.
+ *
+ * Strings in strings.h only serve as templates. Every pluck grabs a free
+ * voice and tunes it like the template. When all voices are sounding, the
+ * quietest one is stolen, the oldest one if there is a tie.
+ *
+ * With CONFIG_SYNTH_DUAL_CORE, a helper task on the other core renders
+ * half of the sounding voices of every block. Only the strings are split,
+ * sample voices (see sampler.h) are all rendered by the playback task.
+ */
+
+/* Core the render helper is pinned to, the playback task takes the other. */
+#define VOICE_HELPER_CORE 1
+
+
+/*
+ * Assign delay lines to all voices.
+ * They are carved from a static arena, there is no allocation later on.
+ * Starts the render helper as well.
+ */
+void voice_init(void);
+
+
+/* Pluck a voice tuned like the given string, excited with noise from rng. */
+void voice_pluck(const struct synth_string *proto, synth_rng_t *rng);
+
+
+/* Dampen the voice most recently plucked from the given string. */
+void voice_dampen(const struct synth_string *proto);
+
+
+/* Add samples of all sounding voices to the buffer. */
+void voice_read(synth_mix_t *out, size_t len);
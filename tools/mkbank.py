@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+#
+# Pack WAV files into a flat sample bank for the storage partition.
+#
+# All samples are converted to a single rate and normalised to the same
+# peak level, so that the firmware can play them without any parsing.
+#
+# The bank is laid out as follows, all integers little-endian:
+#
+#   header   magic "ZBNK", u16 version, u16 count, u32 rate,
+#            u32 total size, u32 CRC-32 of everything after the header
+#   index    count times: char name[16], u32 offset, u32 size,
+#            u32 length, u32 loop start, u32 loop end, u8 format,
+#            3 reserved bytes
+#   payload  mono samples of every entry, each 4 KiB aligned
+#
+# Offsets are from the start of the bank, sizes in bytes and lengths
+# and loop points in samples. A loop end of zero means no loop, samples
+# past the loop end are played once the key is released.
+#
+# Loops come either from the "smpl" chunk of the WAV file or from a list
+# given with --loops, with lines of "name start end [release]" in seconds.
+# When a release is given, the part between the loop end and the release
+# is left out, so that long sustained sounds take up much less space.
+#
+# Samples are stored as:
+#
+#   pcm16    int16
+#   adpcm    IMA-ADPCM in blocks of 256 samples, each starting with
+#            the int16 predictor, u8 step index and a reserved byte,
+#            followed by 4-bit codes, low nibble first
+#   ulaw     8-bit G.711 µ-law
+#
+
+import argparse
+import math
+import os
+import struct
+import wave
+import zlib
+
+
+MAGIC = b'ZBNK'
+VERSION = 3
+HEADER = struct.Struct('<4sHHIII')
+ENTRY = struct.Struct('<16sIIIIIB3x')
+ALIGN = 4096
+
+FORMATS = {'pcm16': 0, 'adpcm': 1, 'ulaw': 2}
+
+ADPCM_BLOCK = 256
+
+ADPCM_STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+
+ADPCM_ADJUST = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+# Taps per phase of the resampling filter.
+TAPS = 32
+
+
+def read_wav(path):
+    with wave.open(path, 'rb') as wav:
+        if wav.getnchannels() != 1 or wav.getsampwidth() != 2:
+            raise SystemExit('%s: only mono 16-bit PCM is supported' % path)
+
+        rate = wav.getframerate()
+        raw = wav.readframes(wav.getnframes())
+
+    return rate, list(struct.unpack('<%ih' % (len(raw) // 2), raw))
+
+
+def read_smpl(path):
+    """First loop of the smpl chunk as [start, end) or None."""
+
+    with open(path, 'rb') as fp:
+        riff = fp.read()
+
+    pos = 12
+
+    while pos + 8 <= len(riff):
+        chunk, size = struct.unpack_from('<4sI', riff, pos)
+
+        if chunk == b'smpl' and size >= 36 + 24:
+            loops = struct.unpack_from('<I', riff, pos + 8 + 28)[0]
+
+            if loops:
+                start, end = struct.unpack_from('<II', riff, pos + 8 + 36 + 8)
+                return start, end + 1
+
+        pos += 8 + size + (size & 1)
+
+    return None
+
+
+def read_loops(path):
+    loops = {}
+
+    with open(path) as fp:
+        for line in fp:
+            line = line.split('#')[0].split()
+
+            if line:
+                times = [float(x) for x in line[1:]]
+                loops[line[0]] = times + [None] * (3 - len(times))
+
+    return loops
+
+
+def crossfade(a, b):
+    """Fade from a over to b, both of the same length."""
+
+    n = len(a)
+    return [round(x + (y - x) * (k + 1) / n) for k, (x, y) in enumerate(zip(a, b))]
+
+
+def cut_loop(data, start, end, release, fade):
+    """Smooth the loop seams and drop what lies between the loop and release."""
+
+    if not 0 <= start < end <= len(data):
+        raise SystemExit('loop %i-%i out of range' % (start, end))
+
+    if release is not None and not end <= release <= len(data):
+        raise SystemExit('release %i out of range' % release)
+
+    orig = list(data)
+    fade = min(fade, start, end - start)
+
+    # Make the loop end run into the loop start like it does into itself,
+    # so that the last sample of the loop becomes the one before its start.
+    data[end - fade:end] = crossfade(orig[end - fade:end], orig[start - fade:start])
+
+    if release is not None:
+        fade = min(fade, len(data) - release)
+
+        # What follows the loop end now is the loop start again, so carry
+        # on with that and fade over to the release.
+        data[release:release + fade] = crossfade(orig[start:start + fade],
+                                                 orig[release:release + fade])
+
+        data = data[:end] + data[release:]
+
+    return data
+
+
+def resample(data, src, dst):
+    """Windowed-sinc resampling by the rational factor dst/src."""
+
+    g = math.gcd(src, dst)
+    up, down = dst // g, src // g
+
+    # Cut off below the lower of the two Nyquist frequencies.
+    cutoff = min(1.0, dst / src) * 0.95
+    half = TAPS // 2
+
+    phases = []
+
+    for p in range(up):
+        frac = p / up
+        taps = []
+
+        for k in range(-half + 1, half + 1):
+            x = k - frac
+            w = 0.5 + 0.5 * math.cos(math.pi * x / half)
+            s = cutoff * (math.sin(math.pi * cutoff * x) / (math.pi * cutoff * x) if x else 1.0)
+            taps.append(w * s)
+
+        phases.append(taps)
+
+    padded = [0.0] * half + data + [0.0] * half
+    out = []
+
+    for n in range(len(data) * up // down):
+        pos = n * down
+        i, p = divmod(pos, up)
+        window = padded[i + 1:i + 1 + TAPS]
+        out.append(sum(a * b for a, b in zip(window, phases[p])))
+
+    return out
+
+
+def normalise(data, level):
+    peak = max((abs(x) for x in data), default=0) or 1.0
+    gain = level * 32767 / peak
+    return [max(-32767, min(32767, round(x * gain))) for x in data]
+
+
+def encode_pcm16(data):
+    return struct.pack('<%ih' % len(data), *data)
+
+
+def encode_adpcm(data):
+    out = bytearray()
+    pred, index = 0, 0
+
+    for start in range(0, len(data), ADPCM_BLOCK):
+        block = data[start:start + ADPCM_BLOCK]
+        block += [block[-1]] * (ADPCM_BLOCK - len(block))
+        out += struct.pack('<hBx', pred, index)
+        codes = []
+
+        for x in block:
+            step = ADPCM_STEPS[index]
+            delta = x - pred
+            code = 8 if delta < 0 else 0
+            delta = abs(delta)
+
+            for bit, scale in ((4, step), (2, step >> 1), (1, step >> 2)):
+                if delta >= scale:
+                    code |= bit
+                    delta -= scale
+
+            # Track the state exactly as the decoder will.
+            diff = step >> 3
+
+            if code & 4:
+                diff += step
+            if code & 2:
+                diff += step >> 1
+            if code & 1:
+                diff += step >> 2
+
+            pred = pred - diff if code & 8 else pred + diff
+            pred = max(-32768, min(32767, pred))
+            index = max(0, min(88, index + ADPCM_ADJUST[code & 7]))
+            codes.append(code)
+
+        out += bytes(codes[i] | codes[i + 1] << 4 for i in range(0, ADPCM_BLOCK, 2))
+
+    return bytes(out)
+
+
+def encode_ulaw(data):
+    out = bytearray()
+
+    for x in data:
+        sign = 0x80 if x < 0 else 0
+        x = min(abs(x), 32635) + 0x84
+        exp = x.bit_length() - 8
+        out.append(~(sign | exp << 4 | (x >> (exp + 3)) & 0x0f) & 0xff)
+
+    return bytes(out)
+
+
+ENCODERS = {'pcm16': encode_pcm16, 'adpcm': encode_adpcm, 'ulaw': encode_ulaw}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack WAV files into a sample bank')
+    parser.add_argument('output', help='bank image to write')
+    parser.add_argument('inputs', nargs='+', help='WAV files, named after their stem')
+    parser.add_argument('--rate', type=int, default=48000, help='sample rate of the bank')
+    parser.add_argument('--peak', type=float, default=-1.0, help='peak level in dBFS')
+    parser.add_argument('--format', choices=FORMATS, default='pcm16', help='sample encoding')
+    parser.add_argument('--loops', help='list of loop points')
+    parser.add_argument('--crossfade', type=float, default=20.0, help='loop crossfade in ms')
+    args = parser.parse_args()
+
+    level = 10 ** (args.peak / 20)
+    loops = read_loops(args.loops) if args.loops else {}
+    entries = []
+
+    for path in args.inputs:
+        name = os.path.splitext(os.path.basename(path))[0].encode()
+
+        if len(name) >= 16:
+            raise SystemExit('%s: name too long' % path)
+
+        rate, data = read_wav(path)
+        loop = read_smpl(path)
+        release = None
+
+        if name.decode() in loops:
+            start, end, release = loops[name.decode()]
+            loop = round(start * rate), round(end * rate)
+            release = None if release is None else round(release * rate)
+
+        if loop:
+            fade = round(args.crossfade * rate / 1000)
+            data = cut_loop(data, loop[0], loop[1], release, fade)
+
+        if rate != args.rate:
+            data = resample(data, rate, args.rate)
+
+            if loop:
+                loop = tuple(round(x * args.rate / rate) for x in loop)
+
+        entries.append((name, normalise(data, level), loop or (0, 0)))
+
+    offset = HEADER.size + ENTRY.size * len(entries)
+    index = b''
+    payload = b''
+
+    for name, data, loop in entries:
+        pad = -(offset + len(payload)) % ALIGN
+        payload += b'\0' * pad
+        blob = ENCODERS[args.format](data)
+        index += ENTRY.pack(name, offset + len(payload), len(blob), len(data),
+                            loop[0], loop[1], FORMATS[args.format])
+        payload += blob
+
+    body = index + payload
+    header = HEADER.pack(MAGIC, VERSION, len(entries), args.rate,
+                         HEADER.size + len(body), zlib.crc32(body))
+
+    with open(args.output, 'wb') as fp:
+        fp.write(header + body)
+
+
+if __name__ == '__main__':
+    main()
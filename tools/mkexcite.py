@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+#
+# Generate a C source with a bank of noise bursts used to pluck strings.
+#
+# The bursts are uniform white noise spanning the whole int16 range.
+# They are derived from a fixed seed, so that the output is reproducible.
+#
+
+import argparse
+import random
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate string excitation bank')
+    parser.add_argument('output', help='C source file to write')
+    parser.add_argument('--count', type=int, default=8, help='number of bursts')
+    parser.add_argument('--length', type=int, default=368, help='samples per burst')
+    parser.add_argument('--seed', type=int, default=0x5eed, help='random seed')
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+
+    with open(args.output, 'w') as fp:
+        fp.write('/* Generated by tools/mkexcite.py, do not edit. */\n\n')
+        fp.write('#include <stdint.h>\n\n')
+        fp.write('const int16_t synth_excitation[%i][%i] = {\n' % (args.count, args.length))
+
+        for _ in range(args.count):
+            burst = [rng.randint(-32768, 32767) for _ in range(args.length)]
+            fp.write('\t{\n')
+
+            for i in range(0, len(burst), 12):
+                fp.write('\t\t' + ', '.join('%i' % x for x in burst[i:i + 12]) + ',\n')
+
+            fp.write('\t},\n')
+
+        fp.write('};\n')
+
+
+if __name__ == '__main__':
+    main()